@@ -144,6 +144,7 @@ void ImGui_ImplSdlGL3_RenderDrawData(ImDrawData* draw_data)
         { 0.0f,                  0.0f,                  -1.0f, 0.0f },
         {-1.0f,                  1.0f,                   0.0f, 1.0f },
     };
+    Shader::forgetBinding();
     g_shader->bind();
     glUniform1i(g_AttribLocationTex, 0);
     glUniformMatrix4fv(g_AttribLocationProjMtx, 1, GL_FALSE, &ortho_projection[0][0]);
@@ -187,11 +188,14 @@ void ImGui_ImplSdlGL3_RenderDrawData(ImDrawData* draw_data)
 
             if (pcmd->UserCallback)
             {
+                Shader* previous = Shader::getBound();
                 pcmd->UserCallback(cmd_list, pcmd);
                 GLDEBUG();
-                GLint p; glGetIntegerv(GL_CURRENT_PROGRAM, &p);
-                auto u = glGetUniformLocation(p, "v_transform");
-                glUniformMatrix4fv(u, 1, GL_FALSE, &ortho_projection[0][0]);
+                // the projection is only sent when the callback changed the program
+                Shader* shader = Shader::getBound();
+                if (shader && shader != previous) {
+                    glUniformMatrix4fv(shader->uniforms.transform, 1, GL_FALSE, &ortho_projection[0][0]);
+                }
                 GLDEBUG();
             }
             else
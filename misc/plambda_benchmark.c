@@ -0,0 +1,88 @@
+// compares the evaluation of common edits by blocks of pixels and by the pixelwise interpreter
+//   cmake -DBUILD_BENCHMARKS=ON .. && make plambda_benchmark && ./plambda_benchmark [w h d]
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "plambda.h"
+
+static double now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// best time of a few runs over all the rows
+static double run(float *out, int pdout, struct plambda_program *p,
+		float **x, int *w, int *h, int *pd, char *error)
+{
+	double best = 1e9;
+	for (int r = 0; r < 3; r++) {
+		double t = now();
+		if (!plambda_run_rows(out, pdout, p, x, w, h, pd, 0, *h, error))
+			return -1;
+		t = now() - t;
+		if (t < best)
+			best = t;
+	}
+	return best;
+}
+
+int main(int argc, char **argv)
+{
+	int W = argc > 1 ? atoi(argv[1]) : 2048;
+	int H = argc > 2 ? atoi(argv[2]) : 2048;
+	int D = argc > 3 ? atoi(argv[3]) : 3;
+	struct { int n; const char *program; } programs[] = {
+		{2, "x y -"},
+		{1, "x 255 /"},
+		{1, "x fabs"},
+		{2, "x y - fabs"},
+		{1, "x[0] x[1] + x[2] + 3 /"},
+		{2, "x 0.5 * y 0.5 * + sqrt"},
+		{2, "x 10 x y - fabs - fmax"},
+	};
+
+	size_t n = (size_t) W * H * D;
+	float *a = malloc(n * sizeof*a);
+	float *b = malloc(n * sizeof*b);
+	float *out = malloc(n * sizeof*out);
+	float *ref = malloc(n * sizeof*ref);
+	for (size_t i = 0; i < n; i++) {
+		a[i] = (float) (i % 509) - 200;
+		b[i] = (float) (i % 251) * 0.75f;
+	}
+	float *x[2] = {a, b};
+	int w[2] = {W, W}, h[2] = {H, H}, pd[2] = {D, D};
+	char error[PLAMBDA_ERROR_SIZE];
+
+	printf("%dx%dx%d\n%-26s %12s %12s %8s\n", W, H, D,
+			"program", "pixelwise", "blocks", "speedup");
+	for (size_t i = 0; i < sizeof programs / sizeof *programs; i++) {
+		struct plambda_program *p = plambda_compile(programs[i].n, programs[i].program, error);
+		if (!p) {
+			printf("%-26s %s\n", programs[i].program, error);
+			continue;
+		}
+		int pdout = plambda_eval_dim(p, x, pd, error);
+		setenv("PLAMBDA_NOBLOCKS", "1", 1);
+		double tref = run(ref, pdout, p, x, w, h, pd, error);
+		unsetenv("PLAMBDA_NOBLOCKS");
+		double t = run(out, pdout, p, x, w, h, pd, error);
+		size_t bytes = (size_t) W * H * (programs[i].n * D + pdout) * sizeof(float);
+		printf("%-26s %9.1f ms %9.1f ms %7.1fx  %.1f GB/s%s\n", programs[i].program,
+				tref * 1e3, t * 1e3, tref / t, bytes / t * 1e-9,
+				memcmp(out, ref, (size_t) W * H * pdout * sizeof*out)
+				? "  (results differ)" : "");
+		plambda_free(p);
+	}
+
+	free(a);
+	free(b);
+	free(out);
+	free(ref);
+	return 0;
+}
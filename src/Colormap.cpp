@@ -22,6 +22,9 @@ Colormap::Colormap()
     shader = nullptr;
     initialized = false;
     currentSat = 0;
+    autoContrast = false;
+    autoContrastValid = false;
+    autoLow = autoHigh = 0.f;
     bands[0] = 0;
     bands[1] = 1;
     bands[2] = 2;
@@ -54,6 +57,11 @@ void Colormap::displaySettings()
     for (int i = 0; i < 3; i++) {
         bands[i] = vals[i];
     }
+
+    if (ImGui::Checkbox("Auto contrast", &autoContrast)) {
+        autoContrastValid = false;
+    }
+    ImGui::SameLine(); ImGui::ShowHelpMarker("Fit the range of each new frame, smoothed over the previous frames (ctrl+shift+a)");
 }
 
 std::array<float, 3> Colormap::getScale() const
@@ -84,6 +92,44 @@ void Colormap::autoCenterAndRadius(float min, float max)
         center[i] = (max + min) / 2.f;
 }
 
+// uses the statistics computed by the loaders, so that it can be called for each frame of a video
+// the range is smoothed over the previous frames to avoid flickering
+void Colormap::followImage(const std::shared_ptr<Image>& img)
+{
+    if (autoContrastValid && img == followedImage.lock())
+        return;
+    followedImage = img;
+    const Image& image = *img;
+
+    float low = std::numeric_limits<float>::max();
+    float high = std::numeric_limits<float>::lowest();
+    for (int d = 0; d < 3; d++) {
+        size_t b = bands[d];
+        if (b >= image.bandLow.size())
+            continue;
+        low = std::min(low, image.bandLow[b]);
+        high = std::max(high, image.bandHigh[b]);
+    }
+    // tiled images have no statistics
+    if (low > high) {
+        low = image.min;
+        high = image.max;
+    }
+    if (low > high)
+        return;
+
+    if (autoContrastValid && gAutoContrastSmoothing > 0) {
+        float s = gAutoContrastSmoothing;
+        low = s * autoLow + (1 - s) * low;
+        high = s * autoHigh + (1 - s) * high;
+    }
+    autoLow = low;
+    autoHigh = high;
+    autoContrastValid = true;
+    autoCenterAndRadius(low, high);
+    initialized = true;
+}
+
 void Colormap::getRange(float& min, float& max, int n) const
 {
     min = std::numeric_limits<float>::max();
@@ -2,6 +2,7 @@
 
 #include <string>
 #include <array>
+#include <memory>
 
 #include "Image.hpp"  // for bands
 
@@ -16,6 +17,13 @@ struct Colormap
     bool initialized;
     int currentSat;
     BandIndices bands;
+    // fit each new frame, see followImage()
+    bool autoContrast;
+    // smoothed range of the previous frames
+    bool autoContrastValid;
+    float autoLow, autoHigh;
+    // the colormap can be shared by several sequences showing the same frame
+    std::weak_ptr<Image> followedImage;
 
     Colormap();
 
@@ -26,6 +34,7 @@ struct Colormap
     std::array<float, 3> getBias() const;
 
     void autoCenterAndRadius(float min, float max);
+    void followImage(const std::shared_ptr<Image>& image);
 
     void nextShader();
     void previousShader();
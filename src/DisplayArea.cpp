@@ -1,3 +1,5 @@
+#include <set>
+
 #include "imgui.h"
 #define IMGUI_DEFINE_MATH_OPERATORS
 #include "imgui_internal.h"
@@ -9,6 +11,10 @@
 #include "Image.hpp"
 #include "DisplayArea.hpp"
 #include "shaders.hpp"
+#include "events.hpp"
+#include "tiles.hpp"
+#include "Pyramid.hpp"
+#include "globals.hpp"
 
 #define S(...) #__VA_ARGS__
 
@@ -27,35 +33,84 @@ void DisplayArea::draw(const std::shared_ptr<Image>& image, ImVec2 pos, ImVec2 w
                        const Colormap* colormap, const View* view, float factor)
 {
     static Shader* checkerboard = createShader(checkerboardFragment);
+    static ImGui::ShaderUserData checkerboardData = {checkerboard, {{1, 1, 1}}, {{0, 0, 0}}};
 
     // update the texture if we have an image
     if (image) {
         ImVec2 imSize(image->w, image->h);
         ImVec2 p1 = view->window2image(ImVec2(0, 0), imSize, winSize, factor);
         ImVec2 p2 = view->window2image(winSize, imSize, winSize, factor);
-        requestTextureArea(image, ImRect(p1, p2), colormap->bands);
+        requestTextureArea(image, ImRect(p1, p2), view->zoom * factor);
     }
 
-    // draw a checkboard pattern
+    // draw a checkboard pattern, the image is drawn right after it without going back to the UI shader
     {
-        ImGui::ShaderUserData* userdata = new ImGui::ShaderUserData;
-        userdata->shader = checkerboard;
-        ImGui::GetWindowDrawList()->AddCallback(ImGui::SetShaderCallback, userdata);
+        ImGui::GetWindowDrawList()->AddCallback(ImGui::SetShaderCallback, &checkerboardData);
         ImVec2 TL = pos;
         ImVec2 BR = pos + winSize;
         ImGui::GetWindowDrawList()->AddImage(0, TL, BR);
+    }
+
+    // the next image is drawn only once it is completely uploaded, until then keep drawing
+    if (nextTexture) {
+        if (!texture || (nextTextureComplete && nextTexture->isReady())) {
+            texture = nextTexture;
+            textureSize = nextTextureSize;
+            textureComplete = nextTextureComplete;
+            nextTexture = nullptr;
+        } else {
+            gActive = std::max(gActive, 2);
+        }
+    }
+    if (!texture) {
         ImGui::GetWindowDrawList()->AddCallback(ImGui::SetShaderCallback, NULL);
+        drawn = false;
+        return;
+    }
+    drawn = true;
+    // the tiles are streamed over the next frames
+    if (!textureComplete) {
+        gActive = std::max(gActive, 2);
     }
 
     // display the texture
-    ImGui::ShaderUserData* userdata = new ImGui::ShaderUserData;
-    userdata->shader = colormap->shader;
-    userdata->scale = colormap->getScale();
-    userdata->bias = colormap->getBias();
-    ImGui::GetWindowDrawList()->AddCallback(ImGui::SetShaderCallback, userdata);
-    for (auto t : texture.tiles) {
-        ImVec2 TL = view->image2window(ImVec2(t.x, t.y), getCurrentSize(), winSize, factor);
-        ImVec2 BR = view->image2window(ImVec2(t.x+t.w, t.y+t.h), getCurrentSize(), winSize, factor);
+    shaderData.shader = colormap->shader;
+    shaderData.scale = colormap->getScale();
+    shaderData.bias = colormap->getBias();
+    // 8 and 16 bits textures are normalized, the colormap applies to the original values
+    for (auto& s : shaderData.scale) {
+        s *= texture->normalization;
+    }
+    ImGui::GetWindowDrawList()->AddCallback(ImGui::SetShaderCallback, &shaderData);
+    // a partially decoded image only shows its valid rows
+    float validHeight = textureSize.y;
+    if (!this->image && loadedPreview.image) {
+        validHeight = std::min(validHeight, (float) loadedPreview.rows * loadedPreview.scale);
+    }
+    // the tiles that are not uploaded yet show the placeholder
+    if (placeholder && !textureComplete) {
+        drawTiles(*placeholder, pos, winSize, colormap, view, factor, validHeight);
+    }
+    drawTiles(*texture, pos, winSize, colormap, view, factor, validHeight);
+    ImGui::GetWindowDrawList()->AddCallback(ImGui::SetShaderCallback, NULL);
+}
+
+void DisplayArea::drawTiles(const Texture& texture, ImVec2 pos, ImVec2 winSize,
+                            const Colormap* colormap, const View* view, float factor, float validHeight)
+{
+    // previews are uploaded by rows, not by tiles
+    bool preview = !this->image && loadedPreview.image;
+    // the first three channels are in the first layer, other bands are selected by the shader
+    bool selectbands = colormap->bands != BANDS_DEFAULT;
+    for (size_t i = 0; i < texture.tiles.size(); i++) {
+        const TextureTile& t = texture.tiles[i];
+        if (t.layer != 0) continue;
+        if (!t.resident && !preview) continue;
+        float bottom = std::min((float) (t.y+t.h)*t.scale, validHeight);
+        if (bottom <= t.y*t.scale) continue;
+        ImVec2 uv1(1, (bottom - t.y*t.scale) / (t.h*t.scale));
+        ImVec2 TL = view->image2window(ImVec2(t.x*t.scale, t.y*t.scale), textureSize, winSize, factor);
+        ImVec2 BR = view->image2window(ImVec2((t.x+t.w)*t.scale, bottom), textureSize, winSize, factor);
 
         TL += pos;
         BR += pos;
@@ -65,40 +120,165 @@ void DisplayArea::draw(const std::shared_ptr<Image>& image, ImVec2 pos, ImVec2 w
         if (TL.y > pos.y + winSize.y) continue;
         if (BR.y < pos.y) continue;
 
-        ImGui::GetWindowDrawList()->AddImage((void*)(size_t)t.id, TL, BR);
+        if (selectbands) {
+            ImGui::LayersUserData* layers = new ImGui::LayersUserData;
+            texture.getLayers(i, colormap->bands, layers->ids, layers->components);
+            ImGui::GetWindowDrawList()->AddCallback(ImGui::SetLayersCallback, layers);
+        }
+        ImGui::GetWindowDrawList()->AddImage((void*)(size_t)t.id, TL, BR, ImVec2(0, 0), uv1);
     }
-    ImGui::GetWindowDrawList()->AddCallback(ImGui::SetShaderCallback, NULL);
 }
 
-void DisplayArea::requestTextureArea(const std::shared_ptr<Image>& image, ImRect rect, BandIndices bandidx)
+void DisplayArea::requestTextureArea(const std::shared_ptr<Image>& image, ImRect rect, float zoom)
 {
+    if (image->isTiled()) {
+        requestTiles(image, rect, zoom);
+        return;
+    }
+
+    // when zoomed out, upload a downsampled version of the image if available
+    size_t scale = 1;
+    while (scale * 2 <= 1.f / zoom) {
+        scale *= 2;
+    }
+    std::shared_ptr<Image> source = image;
+    if (scale > 1) {
+        image->pyramid->request(image);
+        source = image->pyramid->getLevel(scale);
+        if (!source)
+            source = image;
+    }
+
+    rect.Min /= scale;
+    rect.Max /= scale;
     rect.Expand(1.0f);
     rect.Floor();
-    rect.ClipWithFull(ImRect(0, 0, image->w, image->h));
+    rect.ClipWithFull(ImRect(0, 0, source->w, source->h));
 
-    bool reupload = false;
+    if (this->image != image || loadedScale != scale) {
+        this->image = image;
+        loadedPreview = ImagePreview();
+        loadedScale = scale;
+        nextTexture = texture_acquire(source, scale);
+        nextTextureSize = ImVec2(image->w, image->h);
+        placeholder = nullptr;
+    }
+
+    // only the tiles that become visible are uploaded, within the upload budget of the frame
+    if (nextTexture) {
+        nextTextureComplete = nextTexture->makeResident(source, rect, scale);
+    } else {
+        textureComplete = texture->makeResident(source, rect, scale);
+    }
+
+    // while the tiles of the displayed image are streamed, the coarsest level of the pyramid
+    // is shown in their place (the next image is only displayed once complete)
+    if (!nextTexture && !textureComplete && !placeholder) {
+        image->pyramid->requestCoarsest(image);
+        size_t s = std::max(image->w, image->h);
+        std::shared_ptr<Image> level = image->pyramid->getLevel(s);
+        if (level && s > scale) {
+            placeholder = texture_acquire(level, s);
+            placeholderSource = level;
+            placeholderScale = s;
+        }
+    }
+    if (placeholder) {
+        placeholder->makeResident(placeholderSource, ImRect(0, 0, placeholderSource->w, placeholderSource->h), placeholderScale);
+    }
+}
 
+void DisplayArea::requestTiles(const std::shared_ptr<Image>& image, ImRect rect, float zoom)
+{
     if (this->image != image) {
         this->image = image;
-        loadedRect = ImRect();
-        reupload = true;
+        loadedPreview = ImagePreview();
+        // the tiles follow the view of the window, so the texture is not shared
+        texture = std::make_shared<Texture>();
+        textureSize = ImVec2(image->w, image->h);
+        // the tiles of the previous resolution are kept as placeholders instead (see retainTiles below)
+        textureComplete = true;
+        nextTexture = nullptr;
+        placeholder = nullptr;
     }
+    // keep the image in the cache as long as it is displayed
+    letTimeFlow(&image->lastUsed);
 
-    if (!loadedRect.Contains(rect)) {
-        loadedRect.Add(rect);
-        loadedRect.Expand(128);  // to avoid multiple uploads during zoom-out
-        loadedRect.ClipWithFull(ImRect(0, 0, image->w, image->h));
-        reupload = true;
+    rect.Floor();
+    rect.ClipWithFull(ImRect(0, 0, image->w, image->h));
+    if (rect.GetWidth() <= 0 || rect.GetHeight() <= 0) {
+        return;
     }
 
-    if (loadedBands != bandidx) {
-        loadedBands = bandidx;
-        reupload = true;
+    // load the tiles at the coarsest resolution that does not show less than one pixel per screen pixel
+    size_t scale = 1;
+    while (scale * 2 <= 1.f / zoom) {
+        scale *= 2;
     }
 
-    if (reupload) {
-        texture.upload(image, loadedRect, loadedBands);
+    size_t span = TILE_SIZE * scale;
+    size_t tx0 = rect.Min.x / span;
+    size_t ty0 = rect.Min.y / span;
+    size_t tx1 = (rect.Max.x - 1) / span;
+    size_t ty1 = (rect.Max.y - 1) / span;
+
+    std::set<std::string> needed;
+    bool complete = true;
+    for (size_t ty = ty0; ty <= ty1; ty++) {
+        for (size_t tx = tx0; tx <= tx1; tx++) {
+            std::string key = tiles_get_key(*image, tx, ty, scale);
+            needed.insert(key);
+            if (texture->hasTile(key)) {
+                continue;
+            }
+            // the tiles are always queued for loading, only their upload is limited per frame
+            std::shared_ptr<Image> tile = tiles_request(image, tx, ty, scale);
+            if (!tile) {
+                complete = false;
+                continue;
+            }
+            // the range of a tiled image is the range of its tiles seen so far
+            image->min = std::min(image->min, tile->min);
+            image->max = std::max(image->max, tile->max);
+            if (!texture_can_upload()) {
+                complete = false;
+                gActive = std::max(gActive, 2);
+                continue;
+            }
+            texture->uploadTile(key, tile, tx * TILE_SIZE, ty * TILE_SIZE, scale);
+        }
     }
+
+    // keep the tiles of the previous resolution until the current one is fully loaded
+    texture->retainTiles([&](const TextureTile& t) {
+        if (needed.count(t.key))
+            return true;
+        if (complete)
+            return false;
+        ImRect r(t.x * t.scale, t.y * t.scale, (t.x + t.w) * t.scale, (t.y + t.h) * t.scale);
+        return r.Overlaps(rect);
+    });
+}
+
+void DisplayArea::requestPreview(const ImagePreview& preview)
+{
+    bool same = loadedPreview.image == preview.image && loadedPreview.refinements == preview.refinements;
+    if (same && loadedPreview.rows == preview.rows) {
+        return;
+    }
+    // only upload the rows decoded since the last upload
+    size_t from = same ? loadedPreview.rows : 0;
+    image = nullptr;
+    loadedPreview = preview;
+    if (!same) {
+        texture = texture_acquire(preview.image, preview.scale);
+        textureSize = ImVec2(preview.w, preview.h);
+        textureComplete = true;
+        nextTexture = nullptr;
+        placeholder = nullptr;
+    }
+    ImRect rows(0, from, preview.image->w, preview.rows);
+    texture->upload(preview.image, rows, preview.scale);
 }
 
 ImVec2 DisplayArea::getCurrentSize() const
@@ -106,6 +286,9 @@ ImVec2 DisplayArea::getCurrentSize() const
     if (image) {
         return ImVec2(image->w, image->h);
     }
+    if (loadedPreview.image) {
+        return ImVec2(loadedPreview.w, loadedPreview.h);
+    }
     return ImVec2();
 }
 
@@ -4,6 +4,7 @@
 
 #include "Colormap.hpp"
 #include "Texture.hpp"
+#include "imgui_custom.hpp"
 
 struct Image;
 struct Colormap;
@@ -11,22 +12,47 @@ struct View;
 struct Sequence;
 
 class DisplayArea {
-    Texture texture;
+    // shared with the other windows displaying the same image (see texture_acquire)
+    std::shared_ptr<Texture> texture;
+    // the texture of the next image is displayed once it is completely uploaded
+    std::shared_ptr<Texture> nextTexture;
+    // size of the images held by the textures
+    ImVec2 textureSize;
+    ImVec2 nextTextureSize;
+    // whether the tiles covering the view are uploaded, they are streamed within a budget per frame
+    bool textureComplete;
+    bool nextTextureComplete;
+    // coarse level of the pyramid, drawn below the tiles that are not uploaded yet
+    std::shared_ptr<Texture> placeholder;
+    std::shared_ptr<Image> placeholderSource;
+    size_t placeholderScale;
 
     std::shared_ptr<Image> image;
-    ImRect loadedRect;
-    BandIndices loadedBands;
+    ImagePreview loadedPreview;
+    size_t loadedScale;
+    // whether the last draw() showed an image or a preview
+    bool drawn;
+    // given to the draw callback, updated at each draw() instead of being allocated
+    ImGui::ShaderUserData shaderData;
 
 public:
-    DisplayArea() : image(nullptr), loadedBands(BANDS_DEFAULT) {
+    DisplayArea() : textureComplete(true), nextTextureComplete(true), placeholderScale(1),
+                    image(nullptr), loadedScale(1), drawn(false) {
     }
 
     void draw(const std::shared_ptr<Image>& image, ImVec2 pos,
               ImVec2 winSize, const Colormap* colormap, const View* view, float factor);
     ImVec2 getCurrentSize() const;
+    bool hasDrawn() const { return drawn; }
+
+    // show a preview of an image that is not loaded yet, until draw() is given an image
+    void requestPreview(const ImagePreview& preview);
 
 private:
-    void requestTextureArea(const std::shared_ptr<Image>& image, ImRect rect, BandIndices bandidx);
+    void requestTextureArea(const std::shared_ptr<Image>& image, ImRect rect, float zoom);
+    void requestTiles(const std::shared_ptr<Image>& image, ImRect rect, float zoom);
+    void drawTiles(const Texture& texture, ImVec2 pos, ImVec2 winSize,
+                   const Colormap* colormap, const View* view, float factor, float validHeight);
 
 };
 
@@ -81,6 +81,8 @@ std::string EditGUI::getEditorName() const
             return "gmic";
         case OCTAVE:
             return "octave";
+        case BUILTIN:
+            return "builtin";
         default:
             return "";
     }
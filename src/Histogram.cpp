@@ -1,3 +1,6 @@
+#include <limits>
+#include <memory>
+
 #include "imgui.h"
 #define IMGUI_DEFINE_MATH_OPERATORS
 #include "imgui_internal.h"
@@ -10,38 +13,20 @@
 #include "Histogram.hpp"
 
 namespace imscript {
-    // a quad is a square cell bounded by 4 pixels
-    // it knows its four values and its position on the original image
-    struct quad {
-        float abcd[4];
-        int ij;
-    };
-
-    static int compare_floats(const void *a, const void *b)
-    {
-        const float *da = (const float *) a;
-        const float *db = (const float *) b;
-        return (*da > *db) - (*da < *db);
-    }
-
-    static void sort_four_values(float *x)
+    // sort the 4 values of a cell with a sorting network (5 compare-and-swap, no branches once compiled)
+    static inline void sort_four_values(float *x)
     {
-        qsort(x, 4, sizeof*x, compare_floats);
-    }
-
-    // copy the values of a square cell into an array, for easy access
-    static void copy_cell_values(float q[4], float *x, int w, int h, int c, int i, int j)
-    {
-        assert(0 <= i); assert(i < w - 1);
-        assert(0 <= j); assert(j < h - 1);
-        q[0] = x[ ((j+0)*w + (i+0))*c ];
-        q[1] = x[ ((j+0)*w + (i+1))*c ];
-        q[2] = x[ ((j+1)*w + (i+0))*c ];
-        q[3] = x[ ((j+1)*w + (i+1))*c ];
+#define CSWAP(i, j) { float a = x[i], b = x[j]; x[i] = std::min(a, b); x[j] = std::max(a, b); }
+        CSWAP(0, 1);
+        CSWAP(2, 3);
+        CSWAP(0, 2);
+        CSWAP(1, 3);
+        CSWAP(1, 2);
+#undef CSWAP
     }
 
     // obtain the histogram bin that corresponds to the given value
-    static int bin(int n, float m, float M, float x)
+    static inline int bin(int n, float m, float M, float x)
     {
         float f = (n - 1) * (x - m) / (M - m);
         int r = lrint(f);
@@ -49,7 +34,7 @@ namespace imscript {
         return r;
     }
 
-    static int cell_is_degenerate(float m, float M, float q[4])
+    static inline int cell_is_degenerate(float m, float M, float q[4])
     {
         for (int i = 0; i < 4; i++)
             if (q[i] < m || q[i] > M)
@@ -57,34 +42,29 @@ namespace imscript {
         return !(q[0] < q[1] && q[1] < q[2] && q[2] < q[3]);
     }
 
-    static void integrate_values(long double (*o)[2], int n)
+    static void integrate_values(double *o, int n)
     {
         // TODO : multiply each increment by the span of the interval
         for (int i = 1; i < n; i++)
-            o[i][1] += o[i-1][1];// * (o[i][0] - o[i-1][0]);
-        //o[0][1] = 0;
+            o[i] += o[i-1];
     }
 
-    static void accumulate_jumps_for_one_cell(long double (*o)[2],
-                                              int n, float m, float M, float q[4])
+    // accumulate the 2nd derivative of the histogram of the cell in o
+    static inline void accumulate_jumps_for_one_cell(double *o, int n, float m, float M, float q[4])
     {
         // discard degenerate cells
         if (cell_is_degenerate(m, M, q))
             return;
 
         // give nice names to numbers
-        float A = q[0];
-        float B = q[1];
-        float C = q[2];
-        float D = q[3];
-        int i_A = bin(n, m, M, A);
-        int i_B = bin(n, m, M, B);
-        int i_C = bin(n, m, M, C);
-        int i_D = bin(n, m, M, D);
-        A = i_A;
-        B = i_B;
-        C = i_C;
-        D = i_D;
+        int i_A = bin(n, m, M, q[0]);
+        int i_B = bin(n, m, M, q[1]);
+        int i_C = bin(n, m, M, q[2]);
+        int i_D = bin(n, m, M, q[3]);
+        float A = i_A;
+        float B = i_B;
+        float C = i_C;
+        float D = i_D;
 
         if (i_A == i_B || i_B == i_C || i_C == i_D) return;
 
@@ -92,49 +72,236 @@ namespace imscript {
         assert(i_B < i_C);
         assert(i_C < i_D);
 
-        double fac = 1;//33333;
-
         // accumulate jumps
-        o[ i_A ][1] += fac * 2 / (C + D - B - A) / (B - A);
-        o[ i_B ][1] -= fac * 2 / (C + D - B - A) / (B - A);
-        o[ i_C ][1] -= fac * 2 / (C + D - B - A) / (D - C);
-        o[ i_D ][1] += fac * 2 / (C + D - B - A) / (D - C);
-    }
-
-    static void fill_continuous_histogram_simple(
-                                          long double (*o)[2], // output histogram array of (value,density) pairs
-                                          int n,               // requested number of bins for the histogram
-                                          float m,             // requested minimum of the histogram
-                                          float M,             // requested maximum of the histogram
-                                          float *x,            // input image data
-                                          int w,               // input image width
-                                          int h,                // input image height
-                                          int c
-                                         )
-    {
-        // initialize bins (n equidistant points between m and M)
-        for (int i = 0; i < n; i++) {
-            o[i][0] = m + i * (M - m) / n;
-            o[i][1] = 0;
+        o[ i_A ] += 2 / (C + D - B - A) / (B - A);
+        o[ i_B ] -= 2 / (C + D - B - A) / (B - A);
+        o[ i_C ] -= 2 / (C + D - B - A) / (D - C);
+        o[ i_D ] += 2 / (C + D - B - A) / (D - C);
+    }
+}
+
+// number of samples accumulated by a call to progress() in EXACT mode
+#define HISTOGRAM_BAND_SIZE (1<<22)
+
+// 8 and 16 bits samples are first counted per value, and the counts are then gathered into the bins
+template <typename T>
+static void accumulateIntegerRows(std::vector<std::vector<long>>& bins, const Image& image, ImRect region,
+                                  size_t y0, size_t y1, float min, float max)
+{
+    const size_t nvalues = (size_t) std::numeric_limits<T>::max() + 1;
+    const size_t c = image.c;
+    const int nbins = bins[0].size();
+    size_t x0 = region.Min.x;
+    size_t n = (region.Max.x - region.Min.x) * c;
+
+    std::vector<long> counts(nvalues * c);
+    for (size_t y = y0; y < y1; y++) {
+        const T* samples = (const T*) image.samples + (y*image.w + x0)*c;
+        for (size_t i = 0; i < n; i += c) {
+            for (size_t d = 0; d < c; d++) {
+                counts[d*nvalues + samples[i+d]]++;
+            }
         }
+    }
+
+    // nbins-1 because we want the last bin to end at 'max' and not start at 'max'
+    float f = (nbins-1) / (max - min);
+    for (size_t v = 0; v < nvalues; v++) {
+        int bin = (v - min) * f;
+        if (bin < 0 || bin >= nbins)
+            continue;
+        for (size_t d = 0; d < c; d++) {
+            bins[d][bin] += counts[d*nvalues + v];
+        }
+    }
+}
+
+static void accumulateFloatRows(std::vector<std::vector<long>>& bins, const Image& image, ImRect region,
+                                size_t y0, size_t y1, float min, float max)
+{
+    const size_t c = image.c;
+    const unsigned nbins = bins[0].size();
+    size_t x0 = region.Min.x;
+    size_t n = (region.Max.x - region.Min.x) * c;
+    float f = (nbins-1) / (max - min);
 
-        // compute 2nd derivative of histogram
-        for (int j = 0; j < h - 1; j++)
-            for (int i = 0; i < w - 1; i++) {
-                float q[4]; // here we store the 4 values of the cell at (i,j)
-                copy_cell_values(q, x, w, h, c, i, j);
-                sort_four_values(q);
-                accumulate_jumps_for_one_cell(o, n, m, M, q);
+    std::vector<float> row(n);
+    std::vector<long*> hist(c);
+    for (size_t d = 0; d < c; d++) {
+        hist[d] = bins[d].data();
+    }
+    for (size_t y = y0; y < y1; y++) {
+        const float* samples;
+        if (image.type == SAMPLE_F32) {
+            samples = (const float*) image.samples + (y*image.w + x0)*c;
+        } else {
+            image.readSamples((y*image.w + x0)*c, n, row.data());
+            samples = row.data();
+        }
+        for (size_t i = 0; i < n; i += c) {
+            for (size_t d = 0; d < c; d++) {
+                // out of range values (and NaNs) give a negative or too large bin
+                int bin = (samples[i+d] - min) * f;
+                if ((unsigned) bin < nbins) {
+                    hist[d][bin]++;
+                }
             }
+        }
+    }
+}
 
-        // integrate twice
-        integrate_values(o, n);
-        integrate_values(o, n);
+static void accumulateExactRows(std::vector<std::vector<long>>& bins, const Image& image, ImRect region,
+                                size_t y0, size_t y1, float min, float max)
+{
+    if (y1 <= y0 || region.Max.x <= region.Min.x)
+        return;
+    switch (image.type) {
+        case SAMPLE_U8:
+            accumulateIntegerRows<uint8_t>(bins, image, region, y0, y1, min, max);
+            break;
+        case SAMPLE_U16:
+            accumulateIntegerRows<uint16_t>(bins, image, region, y0, y1, min, max);
+            break;
+        default:
+            accumulateFloatRows(bins, image, region, y0, y1, min, max);
+            break;
     }
 }
 
+void HistogramTiles::request(const std::shared_ptr<Image>& image)
+{
+    std::lock_guard<std::mutex> _lock(lock);
+    if (image == this->image.lock() && image->min == min && image->max == max)
+        return;
+    if (image->isTiled())
+        return;
+    this->image = image;
+    min = image->min;
+    max = image->max;
+    c = image->c;
+    ntx = (image->w + HISTOGRAM_TILE_SIZE - 1) / HISTOGRAM_TILE_SIZE;
+    nty = (image->h + HISTOGRAM_TILE_SIZE - 1) / HISTOGRAM_TILE_SIZE;
+    cury = 0;
+    bins.assign(ntx * nty * c * nbins, 0);
+    loaded = false;
+}
+
+float HistogramTiles::getProgressPercentage() const
+{
+    std::lock_guard<std::mutex> _lock(lock);
+    if (loaded) return 1.f;
+    return nty ? (float) cury / nty : 0.f;
+}
+
+void HistogramTiles::progress()
+{
+    // request() can change the image and the layout of the tiles meanwhile
+    std::shared_ptr<Image> image;
+    size_t ty, ntx, nty, c;
+    float min, max;
+    {
+        std::lock_guard<std::mutex> _lock(lock);
+        image = this->image.lock();
+        ty = cury;
+        ntx = this->ntx;
+        nty = this->nty;
+        c = this->c;
+        min = this->min;
+        max = this->max;
+        if (!image || ty >= nty) {
+            loaded = true;
+            return;
+        }
+    }
+
+    // one row of tiles per call
+    std::vector<std::vector<uint32_t>> row(ntx);
+    std::vector<std::vector<long>> tile(c, std::vector<long>(nbins));
+    size_t y0 = ty * HISTOGRAM_TILE_SIZE;
+    size_t y1 = std::min(y0 + HISTOGRAM_TILE_SIZE, image->h);
+    for (size_t tx = 0; tx < ntx; tx++) {
+        size_t x0 = tx * HISTOGRAM_TILE_SIZE;
+        size_t x1 = std::min(x0 + HISTOGRAM_TILE_SIZE, image->w);
+        for (auto& t : tile) {
+            std::fill(t.begin(), t.end(), 0);
+        }
+        accumulateExactRows(tile, *image, ImRect(x0, y0, x1, y1), y0, y1, min, max);
+        row[tx].resize(c * nbins);
+        for (size_t d = 0; d < c; d++) {
+            std::copy(tile[d].begin(), tile[d].end(), row[tx].begin() + d * nbins);
+        }
+    }
+
+    std::lock_guard<std::mutex> _lock(lock);
+    if (image != this->image.lock() || ty != cury || min != this->min || max != this->max) {
+        // someone called request()
+        return;
+    }
+    for (size_t tx = 0; tx < ntx; tx++) {
+        std::copy(row[tx].begin(), row[tx].end(), bins.begin() + (ty * ntx + tx) * c * nbins);
+    }
+    cury++;
+    if (cury == nty) {
+        loaded = true;
+    }
+}
+
+bool HistogramTiles::merge(const Image& image, ImRect inner, float min, float max,
+                           std::vector<std::vector<long>>& values) const
+{
+    std::lock_guard<std::mutex> _lock(lock);
+    if (!loaded || &image != this->image.lock().get() || min != this->min || max != this->max
+        || values.size() != c || values[0].size() != (size_t) nbins) {
+        return false;
+    }
+    size_t tx0 = inner.Min.x / HISTOGRAM_TILE_SIZE;
+    size_t ty0 = inner.Min.y / HISTOGRAM_TILE_SIZE;
+    size_t tx1 = (inner.Max.x + HISTOGRAM_TILE_SIZE - 1) / HISTOGRAM_TILE_SIZE;
+    size_t ty1 = (inner.Max.y + HISTOGRAM_TILE_SIZE - 1) / HISTOGRAM_TILE_SIZE;
+    for (size_t ty = ty0; ty < ty1; ty++) {
+        for (size_t tx = tx0; tx < tx1; tx++) {
+            const uint32_t* t = &bins[(ty * ntx + tx) * c * nbins];
+            for (size_t d = 0; d < c; d++) {
+                for (int b = 0; b < nbins; b++) {
+                    values[d][b] += t[d * nbins + b];
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// the histogram of a region is obtained at once by merging the tile histograms it covers entirely
+// and scanning its borders, returns false if the tile histograms are not available
+static bool computeFromTiles(const Image& image, ImRect region, float min, float max,
+                             std::vector<std::vector<long>>& values)
+{
+    const float T = HISTOGRAM_TILE_SIZE;
+    // the tiles on the right and bottom borders of the image can be smaller
+    ImRect inner;
+    inner.Min.x = std::ceil(region.Min.x / T) * T;
+    inner.Min.y = std::ceil(region.Min.y / T) * T;
+    inner.Max.x = region.Max.x >= image.w ? image.w : std::floor(region.Max.x / T) * T;
+    inner.Max.y = region.Max.y >= image.h ? image.h : std::floor(region.Max.y / T) * T;
+    if (inner.Max.x <= inner.Min.x || inner.Max.y <= inner.Min.y)
+        return false;
+
+    if (!image.histogramTiles->merge(image, inner, min, max, values))
+        return false;
+
+    ImRect full(region.Min.x, 0, region.Max.x, 0);
+    accumulateExactRows(values, image, full, region.Min.y, inner.Min.y, min, max);
+    accumulateExactRows(values, image, full, inner.Max.y, region.Max.y, min, max);
+    accumulateExactRows(values, image, ImRect(region.Min.x, 0, inner.Min.x, 0), inner.Min.y, inner.Max.y, min, max);
+    accumulateExactRows(values, image, ImRect(inner.Max.x, 0, region.Max.x, 0), inner.Min.y, inner.Max.y, min, max);
+    return true;
+}
+
 void Histogram::request(std::shared_ptr<Image> image, Mode mode, ImRect region) {
     std::lock_guard<std::recursive_mutex> _lock(lock);
+    // the pixels of tiled images are not available at once
+    if (image->isTiled())
+        return;
     std::shared_ptr<Image> img = this->image.lock();
     float min = image->min;
     float max = image->max;
@@ -144,6 +311,10 @@ void Histogram::request(std::shared_ptr<Image> image, Mode mode, ImRect region)
     }
     if (image == img && min == this->min && max == this->max && mode == this->mode && region == this->region)
         return;
+    // the tiles only pay off once the selection changes on the same image,
+    // a new frame or a new selection is computed directly
+    if (mode == EXACT && image == img && !(region == this->region))
+        image->histogramTiles->request(image);
     loaded = false;
     this->mode = mode;
     this->min = min;
@@ -151,15 +322,24 @@ void Histogram::request(std::shared_ptr<Image> image, Mode mode, ImRect region)
     this->image = image;
     this->region = region;
     curh = 0;
+    generation++;
 
-    values.clear();
-    values.resize(image->c);
+    std::shared_ptr<Snapshot> empty = std::make_shared<Snapshot>();
+    empty->values.assign(image->c, std::vector<long>(nbins));
+    empty->rows = 0;
 
-    for (size_t d = 0; d < image->c; d++) {
-        auto& histogram = values[d];
-        histogram.clear();
-        histogram.resize(nbins);
+    // typically a selection being dragged, its histogram is shown in the same frame
+    if (mode == EXACT && computeFromTiles(*image, region, min, max, empty->values)) {
+        empty->rows = region.GetHeight();
+        curh = region.GetHeight();
+        loaded = true;
     }
+    std::atomic_store(&snapshot, std::shared_ptr<const Snapshot>(empty));
+}
+
+std::shared_ptr<const Histogram::Snapshot> Histogram::getSnapshot() const
+{
+    return std::atomic_load(&snapshot);
 }
 
 float Histogram::getProgressPercentage() const {
@@ -169,69 +349,136 @@ float Histogram::getProgressPercentage() const {
     return (float) curh / region.GetHeight();
 }
 
+// the cells are squares of 2x2 pixels of the region, a cell row spans two rows of pixels
+// the cell rows [y0,y1) are split between threads whose jumps are then summed
+static void accumulateSmoothRows(std::vector<std::vector<double>>& jumps, const Image& image, ImRect region,
+                                 size_t y0, size_t y1, float min, float max)
+{
+    const size_t c = image.c;
+    const int nbins = jumps[0].size();
+    size_t x0 = region.Min.x;
+    size_t w = region.Max.x - region.Min.x;
+    if (w < 2 || y1 <= y0)
+        return;
+
+    size_t nthreads = std::max(1u, std::thread::hardware_concurrency());
+    nthreads = std::min(nthreads, y1 - y0);
+    std::vector<std::vector<double>> partial(nthreads, std::vector<double>(c * nbins));
+
+    auto work = [&](size_t t) {
+        size_t ya = y0 + (y1 - y0) * t / nthreads;
+        size_t yb = y0 + (y1 - y0) * (t + 1) / nthreads;
+        std::vector<float> r0(w * c);
+        std::vector<float> r1(w * c);
+        double* o = partial[t].data();
+        for (size_t y = ya; y < yb; y++) {
+            image.readSamples((y*image.w + x0)*c, w*c, r0.data());
+            image.readSamples(((y+1)*image.w + x0)*c, w*c, r1.data());
+            for (size_t x = 0; x + 1 < w; x++) {
+                for (size_t d = 0; d < c; d++) {
+                    float q[4] = {r0[x*c+d], r0[(x+1)*c+d], r1[x*c+d], r1[(x+1)*c+d]};
+                    imscript::sort_four_values(q);
+                    imscript::accumulate_jumps_for_one_cell(o + d*nbins, nbins, min, max, q);
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < nthreads; t++) {
+        threads.push_back(std::thread(work, t));
+    }
+    work(0);
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    for (size_t t = 0; t < nthreads; t++) {
+        for (size_t d = 0; d < c; d++) {
+            for (int b = 0; b < nbins; b++) {
+                jumps[d][b] += partial[t][d*nbins + b];
+            }
+        }
+    }
+}
+
 void Histogram::progress()
 {
-    std::vector<std::vector<long>> valuescopy;
-    size_t oldh;
+    // the parameters of the current request, which can change meanwhile
+    size_t gen, oldh;
+    Mode mode;
+    float min, max;
+    ImRect region;
+    std::shared_ptr<Image> image;
     {
         std::lock_guard<std::recursive_mutex> _lock(lock);
-        valuescopy = values;
+        gen = generation;
         oldh = curh;
+        mode = this->mode;
+        min = this->min;
+        max = this->max;
+        region = this->region;
+        image = this->image.lock();
     }
-
-    std::shared_ptr<Image> image = this->image.lock();
     if (!image) return;
 
+    if (accumGeneration != gen) {
+        accum.assign(image->c, std::vector<long>(nbins));
+        jumps.assign(image->c, std::vector<double>(nbins));
+        accumGeneration = gen;
+    }
+
+    size_t newh;
     if (mode == EXACT) {
-        size_t minh = region.Min.y;
-        size_t minx = region.Min.x;
-        size_t maxx = region.Max.x;
-        for (size_t d = 0; d < image->c; d++) {
-            auto& histogram = valuescopy[d];
-            // nbins-1 because we want the last bin to end at 'max' and not start at 'max'
-            float f = (nbins-1) / (max - min);
-            for (size_t i = minx; i < maxx; i++) {
-                // TODO: sometimes it crashes here
-                int bin = (image->pixels[((minh+curh)*image->w + i)*image->c+d] - min) * f;
-                if (bin >= 0 && bin < nbins) {
-                    histogram[bin]++;
-                }
-            }
-        }
-    } else if (mode == SMOOTH) {
-        long double bins[3+nbins][2];
+        // whole bands of rows are accumulated without holding the lock
+        size_t width = std::max((size_t) 1, (size_t) region.GetWidth() * image->c);
+        size_t rows = std::max((size_t) 1, HISTOGRAM_BAND_SIZE / width);
+        newh = std::min(oldh + rows, (size_t) region.GetHeight());
+        size_t y0 = region.Min.y + oldh;
+        size_t y1 = region.Min.y + newh;
+        accumulateExactRows(accum, *image, region, y0, y1, min, max);
+    } else {
+        // the last row of the region only closes the cells of the previous one
+        size_t height = region.GetHeight();
+        size_t cellrows = height ? height - 1 : 0;
+        size_t width = std::max((size_t) 1, (size_t) region.GetWidth() * image->c);
+        size_t rows = std::max((size_t) 1, HISTOGRAM_BAND_SIZE / width);
+        size_t done = std::min(oldh + rows, cellrows);
+        accumulateSmoothRows(jumps, *image, region, region.Min.y + oldh, region.Min.y + done, min, max);
+        newh = done == cellrows ? height : done;
+
+        // the histogram is the second integral of the jumps
         for (size_t d = 0; d < image->c; d++) {
-            imscript::fill_continuous_histogram_simple(bins, nbins, min, max, image->pixels+d, image->w, image->h, image->c);
+            std::vector<double> density = jumps[d];
+            imscript::integrate_values(density.data(), nbins);
+            imscript::integrate_values(density.data(), nbins);
             for (int b = 0; b < nbins; b++) {
-                valuescopy[d][b] = bins[b][1];
+                accum[d][b] = density[b];
             }
         }
     }
 
-    {
-        std::lock_guard<std::recursive_mutex> _lock(lock);
-        if (oldh != curh) {
-            // someone called request()
-            return;
-        }
-        if (mode == EXACT) {
-            curh++;
-        } else {
-            curh = region.GetHeight();
-        }
-
-        if (curh == region.GetHeight()) {
-            loaded = true;
-        }
+    std::shared_ptr<Snapshot> published = std::make_shared<Snapshot>();
+    published->values = accum;
+    published->rows = newh;
 
-        values = valuescopy;
+    std::lock_guard<std::recursive_mutex> _lock(lock);
+    if (generation != gen) {
+        // someone called request()
+        return;
+    }
+    curh = newh;
+    std::atomic_store(&snapshot, std::shared_ptr<const Snapshot>(published));
+    if (curh == region.GetHeight()) {
+        loaded = true;
     }
 }
 
 void Histogram::draw(const Colormap* colormap, const float* highlights)
 {
     std::lock_guard<std::recursive_mutex> _lock(lock);
-    const size_t c = std::min((size_t)3, values.size());
+    std::shared_ptr<const Snapshot> snapshot = getSnapshot();
+    const std::vector<std::vector<long>>& values = snapshot->values;
 
     std::array<float,3> highlightmin, highlightmax;
     colormap->getRange(highlightmin, highlightmax);
@@ -242,7 +489,7 @@ void Histogram::draw(const Colormap* colormap, const float* highlights)
     for (size_t d = 0; d < 3; d++) {
         bandvalids[d] = bands[d] < values.size();
         if (bandvalids[d]) {
-            vals[d] = this->values[bands[d]].data();
+            vals[d] = values[bands[d]].data();
         }
     }
 
@@ -273,7 +520,7 @@ void Histogram::draw(const Colormap* colormap, const float* highlights)
 
     ImGui::Separator();
     ImGui::PlotMultiHistograms("", 3, names, colors, getter, vals,
-                               nbins, FLT_MIN, curh?FLT_MAX:1.f, ImVec2(nbins, 80),
+                               nbins, FLT_MIN, snapshot->rows?FLT_MAX:1.f, ImVec2(nbins, 80),
                                boundsmin, boundsmax, highlights ? bhighlights : 0);
     if (ImGui::BeginPopupContextItem("")) {
         bool smooth = gSmoothHistogram;
@@ -3,6 +3,7 @@
 #include <vector>
 #include <memory>
 #include <mutex>
+#include <thread>
 
 #include "imgui.h"
 #define IMGUI_DEFINE_MATH_OPERATORS
@@ -13,24 +14,44 @@
 struct Image;
 struct Colormap;
 
+#define HISTOGRAM_TILE_SIZE 256
+
 class Histogram : public Progressable {
+public:
+    // bins of each channel and number of rows of the region they cover
+    struct Snapshot {
+        std::vector<std::vector<long>> values;
+        size_t rows;
+    };
+
 private:
     bool loaded;
     mutable std::recursive_mutex lock;
+    // incremented by request(), the rows computed for a previous request are discarded
+    size_t generation;
+    // bins being accumulated by progress(), only accessed by the thread computing the histogram
+    // in SMOOTH mode, the second derivative of the histogram is accumulated instead
+    std::vector<std::vector<long>> accum;
+    std::vector<std::vector<double>> jumps;
+    size_t accumGeneration;
+    // published after each band of rows, draw() reads it without waiting for the computation
+    std::shared_ptr<const Snapshot> snapshot;
+
 public:
     enum Mode {
         SMOOTH,
         EXACT,
     } mode;
     float min, max;
-    std::vector<std::vector<long>> values;
     std::weak_ptr<Image> image;
     size_t curh;
     const int nbins;
     ImRect region;
 
 public:
-    Histogram() : loaded(true), image(std::weak_ptr<Image>()), curh(0), nbins(256), region() {}
+    Histogram() : loaded(true), generation(0), accumGeneration(0),
+                  snapshot(std::make_shared<Snapshot>()), image(std::weak_ptr<Image>()),
+                  curh(0), nbins(256), region() {}
 
     void request(std::shared_ptr<Image> image, Mode mode, ImRect region=ImRect(0,0,0,0));
 
@@ -42,8 +63,43 @@ public:
 
     void progress();
 
+    std::shared_ptr<const Snapshot> getSnapshot() const;
+
     void draw(const Colormap* colormap, const float* highlights);
 
 };
 
+// exact histograms of the tiles of an image, computed once in the background
+// so that the histogram of any region can be obtained by merging them
+class HistogramTiles : public Progressable {
+    bool loaded;
+    mutable std::mutex lock;
+    std::weak_ptr<Image> image;
+    float min, max;
+    size_t ntx, nty, c;
+    // number of rows of tiles computed
+    size_t cury;
+    // nbins per channel per tile, indexed by ((ty*ntx+tx)*c+d)*nbins
+    std::vector<uint32_t> bins;
+
+public:
+    const int nbins;
+
+    HistogramTiles() : loaded(true), min(0), max(0), ntx(0), nty(0), c(0), cury(0), nbins(256) {}
+
+    void request(const std::shared_ptr<Image>& image);
+
+    float getProgressPercentage() const;
+
+    bool isLoaded() const {
+        return loaded;
+    }
+
+    void progress();
+
+    // add the bins of the tiles covering 'inner' (aligned on the tiles) to 'values'
+    // returns false if they are not computed yet or for another range
+    bool merge(const Image& image, ImRect inner, float min, float max,
+               std::vector<std::vector<long>>& values) const;
+};
 
@@ -9,41 +9,285 @@ extern "C" {
 
 #include "Image.hpp"
 #include "Histogram.hpp"
+#include "Pyramid.hpp"
+#include "globals.hpp"
+
+size_t getSampleSize(SampleType type)
+{
+    switch (type) {
+        case SAMPLE_U8: return 1;
+        case SAMPLE_U16: return 2;
+        case SAMPLE_F16: return 2;
+        default: return 4;
+    }
+}
+
+uint16_t floatToHalf(float f)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    uint16_t sign = (bits >> 16) & 0x8000;
+    int exp = (int) ((bits >> 23) & 0xff) - 112;
+    uint32_t mant = bits & 0x7fffff;
+    if (exp >= 0x1f) {
+        // infinity, nan or too large
+        bool nan = ((bits >> 23) & 0xff) == 0xff && mant;
+        return sign | 0x7c00 | (nan ? 0x200 : 0);
+    }
+    if (exp <= 0) {
+        if (exp < -10)
+            return sign;
+        // subnormal
+        mant |= 0x800000;
+        uint32_t shift = 14 - exp;
+        uint16_t h = mant >> shift;
+        if ((mant >> (shift - 1)) & 1)
+            h++;
+        return sign | h;
+    }
+    uint16_t h = sign | (exp << 10) | (mant >> 13);
+    // round to nearest, a carry correctly moves to the exponent
+    if (mant & 0x1000)
+        h++;
+    return h;
+}
+
+static int imageCount = 0;
 
 Image::Image(float* pixels, size_t w, size_t h, size_t c)
-    : pixels(pixels), w(w), h(h), c(c), lastUsed(0), histogram(std::make_shared<Histogram>())
+    : Image((void*) pixels, SAMPLE_F32, w, h, c)
 {
-    static int id = 0;
-    id++;
-    ID = "Image " + std::to_string(id);
+}
+
+Image::Image(void* samples, SampleType type, size_t w, size_t h, size_t c)
+    : samples(samples), type(type), w(w), h(h), c(c), lastUsed(0), histogram(std::make_shared<Histogram>()),
+      histogramTiles(std::make_shared<HistogramTiles>()), pyramid(std::make_shared<Pyramid>())
+{
+    imageCount++;
+    ID = "Image " + std::to_string(imageCount);
+
+    computeRange();
+    size = ImVec2(w, h);
+}
+
+Image::Image(size_t w, size_t h, size_t c, SampleType type)
+    : samples(malloc(getSampleSize(type) * w * h * c)), type(type), w(w), h(h), c(c), lastUsed(0),
+      histogram(std::make_shared<Histogram>()), histogramTiles(std::make_shared<HistogramTiles>()),
+      pyramid(std::make_shared<Pyramid>())
+{
+    imageCount++;
+    ID = "Image " + std::to_string(imageCount);
 
     min = std::numeric_limits<float>::max();
     max = std::numeric_limits<float>::lowest();
-    for (size_t i = 0; i < w*h*c; i++) {
-        float v = pixels[i];
-        min = std::min(min, v);
-        max = std::max(max, v);
+    size = ImVec2(w, h);
+}
+
+// range of each band, non-finite values are only skipped when 'finite' is set (slower)
+// the samples are read in a single pass, whatever the number of bands
+template <typename T>
+static void getBandRanges(const T* data, size_t n, size_t c, bool finite,
+                          std::vector<float>& min, std::vector<float>& max)
+{
+    min.assign(c, std::numeric_limits<float>::max());
+    max.assign(c, std::numeric_limits<float>::lowest());
+    float* lo = &min[0];
+    float* hi = &max[0];
+    for (size_t i = 0; i < n; i += c) {
+        for (size_t d = 0; d < c; d++) {
+            float v = data[i + d];
+            if (finite && !std::isfinite(v))
+                continue;
+            lo[d] = std::min(lo[d], v);
+            hi[d] = std::max(hi[d], v);
+        }
+    }
+}
+
+// samples at the quantiles q and 1-q of each band, from a histogram of 1024 bins per band
+template <typename T>
+static void getBandQuantiles(const T* data, size_t n, size_t c, float q,
+                             std::vector<float>& low, std::vector<float>& high)
+{
+    const int nbins = 1024;
+    for (size_t d = 0; d < c; d++) {
+        float min = low[d];
+        float max = high[d];
+        if (!(min < max))
+            continue;
+        float f = (nbins - 1) / (max - min);
+        std::vector<size_t> counts(nbins);
+        size_t total = 0;
+        for (size_t i = d; i < n; i += c) {
+            float v = data[i];
+            if (!(v >= min && v <= max))
+                continue;
+            counts[(int) ((v - min) * f)]++;
+            total++;
+        }
+        if (!total)
+            continue;
+
+        size_t ranks[2] = {(size_t) (q * total), std::min((size_t) ((1 - q) * total), total - 1)};
+        float values[2];
+        for (int k = 0; k < 2; k++) {
+            size_t rank = ranks[k];
+            int b = 0;
+            while (b < nbins - 1 && rank >= counts[b]) {
+                rank -= counts[b];
+                b++;
+            }
+            values[k] = std::min(max, min + (b + (rank + .5f) / counts[b]) / f);
+        }
+        low[d] = values[0];
+        high[d] = values[1];
     }
-    if (!std::isfinite(min) || !std::isfinite(max)) {
-        min = std::numeric_limits<float>::max();
-        max = std::numeric_limits<float>::lowest();
-        for (size_t i = 0; i < w*h*c; i++) {
-            float v = pixels[i];
-            if (std::isfinite(v)) {
-                min = std::min(min, v);
-                max = std::max(max, v);
+}
+
+void Image::computeRange()
+{
+    min = std::numeric_limits<float>::max();
+    max = std::numeric_limits<float>::lowest();
+    bandLow.assign(c, min);
+    bandHigh.assign(c, max);
+    size_t n = w*h*c;
+    if (!n)
+        return;
+
+    // integer samples are always finite
+    std::vector<float> buffer;
+    const float* pixels = nullptr;
+    if (type == SAMPLE_U8) {
+        getBandRanges((const uint8_t*) samples, n, c, false, bandLow, bandHigh);
+    } else if (type == SAMPLE_U16) {
+        getBandRanges((const uint16_t*) samples, n, c, false, bandLow, bandHigh);
+    } else {
+        pixels = getFloatPixels(buffer);
+        getBandRanges(pixels, n, c, false, bandLow, bandHigh);
+        for (size_t d = 0; d < c; d++) {
+            if (!std::isfinite(bandLow[d]) || !std::isfinite(bandHigh[d])) {
+                getBandRanges(pixels, n, c, true, bandLow, bandHigh);
+                break;
             }
         }
     }
+    for (size_t d = 0; d < c; d++) {
+        min = std::min(min, bandLow[d]);
+        max = std::max(max, bandHigh[d]);
+    }
+
+    // computed by the loaders so that the auto contrast costs nothing during playback
+    if (gAutoContrastQuantile > 0) {
+        if (type == SAMPLE_U8) {
+            getBandQuantiles((const uint8_t*) samples, n, c, gAutoContrastQuantile, bandLow, bandHigh);
+        } else if (type == SAMPLE_U16) {
+            getBandQuantiles((const uint16_t*) samples, n, c, gAutoContrastQuantile, bandLow, bandHigh);
+        } else {
+            getBandQuantiles(pixels, n, c, gAutoContrastQuantile, bandLow, bandHigh);
+        }
+    }
+}
+
+void Image::readSamples(size_t i, size_t n, float* out) const
+{
+    switch (type) {
+        case SAMPLE_U8: {
+            const uint8_t* data = (const uint8_t*) samples + i;
+            for (size_t j = 0; j < n; j++)
+                out[j] = data[j];
+            break;
+        }
+        case SAMPLE_U16: {
+            const uint16_t* data = (const uint16_t*) samples + i;
+            for (size_t j = 0; j < n; j++)
+                out[j] = data[j];
+            break;
+        }
+        case SAMPLE_F16: {
+            const uint16_t* data = (const uint16_t*) samples + i;
+            for (size_t j = 0; j < n; j++)
+                out[j] = halfToFloat(data[j]);
+            break;
+        }
+        default:
+            std::copy((const float*) samples + i, (const float*) samples + i + n, out);
+    }
+}
+
+template <typename T>
+static T clampRound(float v)
+{
+    if (!(v > 0))
+        return 0;
+    if (v >= std::numeric_limits<T>::max())
+        return std::numeric_limits<T>::max();
+    return (T) (v + 0.5f);
+}
+
+void Image::writeSamples(size_t i, size_t n, const float* in)
+{
+    switch (type) {
+        case SAMPLE_U8: {
+            uint8_t* data = (uint8_t*) samples + i;
+            for (size_t j = 0; j < n; j++)
+                data[j] = clampRound<uint8_t>(in[j]);
+            break;
+        }
+        case SAMPLE_U16: {
+            uint16_t* data = (uint16_t*) samples + i;
+            for (size_t j = 0; j < n; j++)
+                data[j] = clampRound<uint16_t>(in[j]);
+            break;
+        }
+        case SAMPLE_F16: {
+            uint16_t* data = (uint16_t*) samples + i;
+            for (size_t j = 0; j < n; j++)
+                data[j] = floatToHalf(in[j]);
+            break;
+        }
+        default:
+            std::copy(in, in + n, (float*) samples + i);
+    }
+}
+
+const float* Image::getFloatPixels(std::vector<float>& buffer) const
+{
+    if (type == SAMPLE_F32)
+        return (const float*) samples;
+    buffer.resize(w * h * c);
+    readSamples(0, w * h * c, &buffer[0]);
+    return &buffer[0];
+}
+
+Image::Image(std::shared_ptr<TileSource> tilesource, size_t w, size_t h, size_t c)
+    : samples(nullptr), type(SAMPLE_F32), w(w), h(h), c(c), lastUsed(0), histogram(std::make_shared<Histogram>()),
+      histogramTiles(std::make_shared<HistogramTiles>()), pyramid(std::make_shared<Pyramid>()),
+      tilesource(tilesource)
+{
+    static int id = 0;
+    id++;
+    ID = "Tiled image " + std::to_string(id);
+
+    min = std::numeric_limits<float>::max();
+    max = std::numeric_limits<float>::lowest();
     size = ImVec2(w, h);
 }
 
 #include "ImageCache.hpp"
 #include "ImageProvider.hpp"
+#include "tiles.hpp"
 Image::~Image()
 {
     LOG("free image");
-    free(pixels);
+    free(samples);
+}
+
+size_t Image::getMemorySize() const
+{
+    // the tiles are accounted for separately by the cache
+    if (isTiled())
+        return 0;
+    return w * h * c * getSampleSize(type) + pyramid->getMemorySize();
 }
 
 void Image::getPixelValueAt(size_t x, size_t y, float* values, size_t d) const
@@ -51,12 +295,15 @@ void Image::getPixelValueAt(size_t x, size_t y, float* values, size_t d) const
     if (x >= w || y >= h)
         return;
 
-    const float* data = (float*) pixels + (w * y + x)*c;
-    const float* end = (float*) pixels + (w * h)*c;
-    for (size_t i = 0; i < d; i++) {
-        if (data + i >= end) break;
-        values[i] = data[i];
+    if (isTiled()) {
+        std::shared_ptr<Image> tile = tiles_get_cached(*this, x, y);
+        if (tile)
+            tile->getPixelValueAt(x % TILE_SIZE, y % TILE_SIZE, values, d);
+        return;
     }
+
+    size_t i = (w * y + x)*c;
+    readSamples(i, std::min(d, w*h*c - i), values);
 }
 
 std::array<bool,3> Image::getPixelValueAtBands(size_t x, size_t y, BandIndices bands, float* values) const
@@ -65,11 +312,18 @@ std::array<bool,3> Image::getPixelValueAtBands(size_t x, size_t y, BandIndices b
     if (x >= w || y >= h)
         return valids;
 
-    const float* data = (float*) pixels + (w * y + x)*c;
+    if (isTiled()) {
+        std::shared_ptr<Image> tile = tiles_get_cached(*this, x, y);
+        if (tile)
+            valids = tile->getPixelValueAtBands(x % TILE_SIZE, y % TILE_SIZE, bands, values);
+        return valids;
+    }
+
+    size_t i0 = (w * y + x)*c;
     for (size_t i = 0; i < 3; i++) {
         int b = bands[i];
         if (b >= c) continue;
-        values[i] = data[b];
+        values[i] = getSample(i0 + b);
         valids[i] = true;
     }
     return valids;
@@ -4,41 +4,137 @@
 #include <memory>
 #include <string>
 #include <array>
+#include <vector>
+#include <cstdint>
+#include <cstring>
 
 #include "imgui.h"
 
-#if 0
-struct ImageTile {
-    unsigned id;
-    int x, y;
-    size_t w, h, c;
-    size_t scale;
-    std::vector<float> pixels;
-};
-#endif
-
 typedef std::array<size_t,3> BandIndices;
 #define BANDS_DEFAULT (BandIndices{0,1,2})
 
 class Histogram;
+class HistogramTiles;
+class Pyramid;
+
+// random access to the pixels of an image too large to be loaded at once
+class TileSource {
+public:
+    virtual ~TileSource() {
+    }
+
+    // read a w*h area starting at (x,y), taking one pixel every 'scale' pixels
+    virtual bool read(size_t x, size_t y, size_t w, size_t h, size_t scale, float* out) = 0;
+};
+
+// type of the samples as they are stored in memory
+enum SampleType {
+    SAMPLE_U8,
+    SAMPLE_U16,
+    SAMPLE_F16,
+    SAMPLE_F32,
+};
+
+size_t getSampleSize(SampleType type);
+
+// IEEE 754 half precision floats
+static inline float halfToFloat(uint16_t h)
+{
+    uint32_t sign = (uint32_t) (h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    uint32_t bits;
+    if (exp == 0x1f) {
+        bits = sign | 0x7f800000 | (mant << 13);
+    } else if (exp) {
+        bits = sign | ((exp + 112) << 23) | (mant << 13);
+    } else if (mant) {
+        // subnormal, normalize it
+        exp = 113;
+        while (!(mant & 0x400)) {
+            mant <<= 1;
+            exp--;
+        }
+        bits = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+    } else {
+        bits = sign;
+    }
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+uint16_t floatToHalf(float f);
 
 struct Image {
     std::string ID;
-    float* pixels;
+    // interleaved samples of type 'type', 8 and 16 bits images are kept as such to save memory
+    // use getSample/readSamples to get their values as float
+    void* samples;
+    SampleType type;
     size_t w, h, c;
     ImVec2 size;
     float min;
     float max;
+    // samples at the quantiles AUTO_CONTRAST_QUANTILE and 1-AUTO_CONTRAST_QUANTILE of each band
+    // (its range by default), computed with the range, used by the auto contrast of the colormaps
+    std::vector<float> bandLow;
+    std::vector<float> bandHigh;
     uint64_t lastUsed;
     std::shared_ptr<Histogram> histogram;
+    std::shared_ptr<HistogramTiles> histogramTiles;
+    std::shared_ptr<Pyramid> pyramid;
+
+    // set for tiled images, in which case 'samples' is null (see tiles.hpp)
+    // their range grows as their tiles get loaded
+    std::shared_ptr<TileSource> tilesource;
 
     std::set<std::string> usedBy;
 
     Image(float* pixels, size_t w, size_t h, size_t c);
+    Image(void* samples, SampleType type, size_t w, size_t h, size_t c);
+    // allocates the pixels, to be filled progressively by a provider which then calls computeRange()
+    Image(size_t w, size_t h, size_t c, SampleType type=SAMPLE_F32);
+    Image(std::shared_ptr<TileSource> tilesource, size_t w, size_t h, size_t c);
     ~Image();
 
+    bool isTiled() const { return tilesource != nullptr; }
+    size_t getMemorySize() const;
+    void computeRange();
+
+    // value of the i-th sample
+    float getSample(size_t i) const {
+        switch (type) {
+            case SAMPLE_U8: return ((const uint8_t*) samples)[i];
+            case SAMPLE_U16: return ((const uint16_t*) samples)[i];
+            case SAMPLE_F16: return halfToFloat(((const uint16_t*) samples)[i]);
+            default: return ((const float*) samples)[i];
+        }
+    }
+    // convert n samples starting at the i-th one to float
+    void readSamples(size_t i, size_t n, float* out) const;
+    // store n samples starting at the i-th one, rounded and clamped to the sample type
+    void writeSamples(size_t i, size_t n, const float* in);
+    // all the samples as float, converted into 'buffer' unless they are stored as float
+    const float* getFloatPixels(std::vector<float>& buffer) const;
+
     void getPixelValueAt(size_t x, size_t y, float* values, size_t d) const;
     std::array<bool,3> getPixelValueAtBands(size_t x, size_t y, BandIndices bands, float* values) const;
 
 };
 
+// downsampled or partially decoded version of an image that is still being loaded
+struct ImagePreview {
+    std::shared_ptr<Image> image;
+    // the image is reduced by this factor compared to the full image
+    size_t scale = 1;
+    // size of the full image
+    size_t w = 0, h = 0;
+    // number of rows of the preview image that are already decoded
+    size_t rows = 0;
+    // incremented when the rows that were already published are refined (eg. interlaced PNG)
+    int refinements = 0;
+    // range of the decoded rows
+    float min = 0, max = 0;
+};
+
@@ -3,6 +3,7 @@
 #include <unordered_map>
 #include <mutex>
 #include <cstdlib>
+#include <algorithm>
 
 #include "Image.hpp"
 #include "ImageCache.hpp"
@@ -16,6 +17,7 @@ namespace ImageCache {
     static std::mutex lock;
     static size_t cacheSize = 0;
     static bool cacheFull = false;
+    static std::function<void()> storeCallback;
 
     bool has(const std::string& key)
     {
@@ -26,8 +28,10 @@ namespace ImageCache {
     std::shared_ptr<Image> get(const std::string& key)
     {
         std::lock_guard<std::mutex> _lock(lock);
-        std::shared_ptr<Image> image = cache[key];
-        return image;
+        auto i = cache.find(key);
+        if (i == cache.end())
+            return nullptr;
+        return i->second;
     }
 
     std::shared_ptr<Image> getById(const std::string& id)
@@ -43,14 +47,14 @@ namespace ImageCache {
 
     static bool hasSpaceFor(const std::shared_ptr<Image>& image)
     {
-        size_t need = image->w * image->h * image->c * sizeof(float);
+        size_t need = image->getMemorySize();
         size_t limit = gCacheLimitMB*1000000;
         return cacheSize + need < limit;
     }
 
     static bool makeRoomFor(const std::shared_ptr<Image>& image)
     {
-        size_t need = image->w * image->h * image->c * sizeof(float);
+        size_t need = image->getMemorySize();
         size_t limit = gCacheLimitMB*1000000;
 
         if (need > limit) return false;
@@ -74,9 +78,20 @@ namespace ImageCache {
         return true;
     }
 
+    // the images can grow once stored, when the levels of their pyramid are computed
+    static size_t computeCacheSize()
+    {
+        size_t size = 0;
+        for (auto& c : cache) {
+            size += c.second->getMemorySize();
+        }
+        return size;
+    }
+
     void store(const std::string& key, std::shared_ptr<Image> image)
     {
         std::lock_guard<std::mutex> _lock(lock);
+        cacheSize = computeCacheSize();
 
         letTimeFlow(&image->lastUsed);
 
@@ -97,8 +112,17 @@ namespace ImageCache {
             cacheFull = false;
         }
         cache[key] = image;
-        cacheSize += image->w * image->h * image->c * sizeof(float);
+        cacheSize += image->getMemorySize();
         LOG2("store image " << key << " " << image);
+        if (storeCallback) {
+            storeCallback();
+        }
+    }
+
+    void setStoreCallback(std::function<void()> callback)
+    {
+        std::lock_guard<std::mutex> _lock(lock);
+        storeCallback = callback;
     }
 
     bool remove_rec(const std::string& key)
@@ -108,7 +132,7 @@ namespace ImageCache {
             std::shared_ptr<Image> image = i->second;
             LOG2("remove image " << key << " " << image);
             cache.erase(i);
-            cacheSize -= image->w * image->h * image->c * sizeof(float);
+            cacheSize -= std::min(cacheSize, image->getMemorySize());
             for (auto k : image->usedBy) {
                 LOG2("try remove " << k);
                 remove_rec(k);
@@ -2,6 +2,7 @@
 
 #include <string>
 #include <memory>
+#include <functional>
 
 struct Image;
 
@@ -13,6 +14,8 @@ namespace ImageCache {
     std::shared_ptr<Image> getById(const std::string& id);  // this is very bad
 
     void store(const std::string& key, std::shared_ptr<Image> image);
+    // called by the thread storing an image, after it entered the cache
+    void setStoreCallback(std::function<void()> callback);
 
     bool remove(const std::string& key);
     bool remove_rec(const std::string& key);
@@ -104,18 +104,16 @@ class VPPVideoImageProvider : public VideoImageProvider {
     FILE* file;
     int w, h, d;
     int curh;
-    float* pixels;
+    std::shared_ptr<Image> image;
 public:
     VPPVideoImageProvider(const std::string& filename, int index, int w, int h, int d)
         : VideoImageProvider(filename, index),
           file(fopen(filename.c_str(), "r")), w(w), h(h), d(d), curh(0) {
         fseek(file, 4+3*sizeof(int)+w*h*d*sizeof(float)*index, SEEK_SET);
-        pixels = (float*) malloc(w*h*d*sizeof(float));
+        image = std::make_shared<Image>(w, h, d);
     }
 
     ~VPPVideoImageProvider() {
-        if (pixels)
-            free(pixels);
         fclose(file);
     }
 
@@ -125,14 +123,14 @@ public:
 
     void progress() {
         if (curh < h) {
-            if (!fread(pixels+curh*w*d, sizeof(float), w*d, file)) {
+            if (!fread((float*) image->samples+curh*w*d, sizeof(float), w*d, file)) {
                 onFinish(makeError("error vpp"));
             }
             curh++;
+            onPartialImage(image, curh);
         } else {
-            auto image = std::make_shared<Image>(pixels, w, h, d);
+            image->computeRange();
             onFinish(image);
-            pixels = nullptr;
         }
     }
 };
@@ -202,9 +200,19 @@ public:
         if (fread(data, 1, framesize, file) != framesize) {
             onFinish(makeError("npy: couldn't read frame"));
         }
-        // convert to float
-        float* pixels = npy_convert_to_float(data, w * h * d, ni.type);
-        auto image = std::make_shared<Image>(pixels, w, h, d);
+        // 8 and 16 bits unsigned samples are kept as such, the others are converted to float
+        std::shared_ptr<Image> image;
+        const char* desc = ni.desc;
+        if (*desc == '<' || *desc == '|' || *desc == '=')
+            desc++;
+        if ((!strcmp(desc, "u1") || !strcmp(desc, "b1")) && ni.desc[0] != '>') {
+            image = std::make_shared<Image>(data, SAMPLE_U8, w, h, d);
+        } else if (!strcmp(desc, "u2") && ni.desc[0] != '>') {
+            image = std::make_shared<Image>(data, SAMPLE_U16, w, h, d);
+        } else {
+            float* pixels = npy_convert_to_float(data, w * h * d, ni.type);
+            image = std::make_shared<Image>(pixels, w, h, d);
+        }
         onFinish(image);
     }
 };
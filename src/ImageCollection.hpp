@@ -7,8 +7,10 @@
 
 struct Image;
 class ImageProvider;
+class Reduction;
 
 class ImageCollection {
+    mutable std::shared_ptr<Reduction> reduction;
 
 public:
     virtual ~ImageCollection() {
@@ -18,6 +20,11 @@ public:
     virtual const std::string& getFilename(int index) const = 0;
     virtual std::string getKey(int index) const = 0;
     virtual void onFileReload(const std::string& filename) = 0;
+
+    // statistics over all the frames, started by the first call and then kept with the collection
+    std::shared_ptr<Reduction> getReduction() const;
+    // the next getReduction() starts over, for example when a file of the collection changed
+    void resetReduction() const;
 };
 
 ImageCollection* buildImageCollectionFromFilenames(std::vector<std::string>& filenames);
@@ -1,4 +1,7 @@
 #include <errno.h>
+#include <cmath>
+#include <mutex>
+#include <algorithm>
 
 extern "C" {
 #include "iio.h"
@@ -7,6 +10,46 @@ extern "C" {
 #include "Image.hpp"
 #include "editors.hpp"
 #include "ImageProvider.hpp"
+#include "globals.hpp"
+#include "tiles.hpp"
+
+void ImageProvider::onPartialImage(const std::shared_ptr<Image>& image, size_t rows, bool refined)
+{
+    if (!isPreviewWanted())
+        return;
+
+    size_t from;
+    {
+        std::lock_guard<std::mutex> _lock(previewLock);
+        from = preview.image == image && !refined ? preview.rows : 0;
+    }
+    if (rows <= from && !refined)
+        return;
+
+    // the range of the new rows, computed here to avoid scanning them on the main thread
+    size_t rowsize = image->w * image->c;
+    std::vector<float> row(rowsize);
+    for (size_t y = from; y < rows; y++) {
+        image->readSamples(y * rowsize, rowsize, &row[0]);
+        for (float v : row) {
+            if (std::isfinite(v)) {
+                partialMin = std::min(partialMin, v);
+                partialMax = std::max(partialMax, v);
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> _lock(previewLock);
+    if (preview.image == image && refined)
+        preview.refinements++;
+    preview.image = image;
+    preview.scale = 1;
+    preview.w = image->w;
+    preview.h = image->h;
+    preview.rows = rows;
+    preview.min = partialMin;
+    preview.max = partialMax;
+}
 
 static std::shared_ptr<Image> load_from_iio(const std::string& filename)
 {
@@ -32,17 +75,72 @@ void IIOFileImageProvider::progress()
 #ifdef USE_GDAL
 #include <gdal.h>
 #include <gdal_priv.h>
+
+class GDALTileSource : public TileSource {
+    GDALDataset* g;
+    std::mutex lock;
+
+public:
+    GDALTileSource(GDALDataset* g) : g(g) {
+    }
+
+    virtual ~GDALTileSource() {
+        GDALClose(g);
+    }
+
+    virtual bool read(size_t x, size_t y, size_t w, size_t h, size_t scale, float* out) {
+        std::lock_guard<std::mutex> _lock(lock);
+        int d = g->GetRasterCount();
+        int sw = std::min(w * scale, g->GetRasterXSize() - x);
+        int sh = std::min(h * scale, g->GetRasterYSize() - y);
+        // when decimating, gdal reads from the overviews of the file if it has some
+        GDALRasterIOExtraArg args;
+        INIT_RASTERIO_EXTRA_ARG(args);
+        args.eResampleAlg = GRIORA_Average;
+        CPLErr err = g->RasterIO(GF_Read, x, y, sw, sh, out, w, h, GDT_Float32, d,
+                                 NULL, sizeof(float)*d, sizeof(float)*w*d, sizeof(float),
+                                 &args);
+        return err == CE_None;
+    }
+};
+
 void GDALFileImageProvider::progress()
 {
     GDALDataset* g = (GDALDataset*) GDALOpen(filename.c_str(), GA_ReadOnly);
     if (!g) {
         onFinish(makeError("gdal: cannot load image '" + filename + "'"));
+        return;
     }
 
     int w = g->GetRasterXSize();
     int h = g->GetRasterYSize();
     int d = g->GetRasterCount();
-    float* pixels = (float*) malloc(sizeof(float) * w * h * d);
+
+    // huge images are read on demand, one tile at a time
+    if (sizeof(float) * w * h * d > gTiledLoadingThresholdMB * 1000000) {
+        std::shared_ptr<TileSource> source = std::make_shared<GDALTileSource>(g);
+        onFinish(std::make_shared<Image>(source, w, h, d));
+        return;
+    }
+
+    // 8 and 16 bits rasters are kept as such
+    SampleType type = SAMPLE_F32;
+    GDALDataType gdaltype = GDT_Float32;
+    GDALDataType bandtype = g->GetRasterBand(1)->GetRasterDataType();
+    bool sametype = true;
+    for (int b = 2; b <= d; b++) {
+        sametype &= g->GetRasterBand(b)->GetRasterDataType() == bandtype;
+    }
+    if (sametype && bandtype == GDT_Byte) {
+        type = SAMPLE_U8;
+        gdaltype = GDT_Byte;
+    } else if (sametype && bandtype == GDT_UInt16) {
+        type = SAMPLE_U16;
+        gdaltype = GDT_UInt16;
+    }
+    size_t ss = getSampleSize(type);
+
+    void* pixels = malloc(ss * w * h * d);
     GDALRasterIOExtraArg args;
     INIT_RASTERIO_EXTRA_ARG(args);
     args.pfnProgress = [](double d, const char*, void* data){
@@ -50,16 +148,17 @@ void GDALFileImageProvider::progress()
         return 1;
     };
     args.pProgressData = this;
-    CPLErr err = g->RasterIO(GF_Read, 0, 0, w, h, pixels, w, h, GDT_Float32, d,
-                             NULL, sizeof(float)*d, sizeof(float)*w*d, sizeof(float),
+    CPLErr err = g->RasterIO(GF_Read, 0, 0, w, h, pixels, w, h, gdaltype, d,
+                             NULL, ss*d, ss*w*d, ss,
                              &args);
     GDALClose(g);
 
     if (err != CE_None) {
+        free(pixels);
         onFinish(makeError("gdal: cannot load image '" + filename +
                            "' err:" + std::to_string(err)));
     } else {
-        std::shared_ptr<Image> image = std::make_shared<Image>(pixels, w, h, d);
+        std::shared_ptr<Image> image = std::make_shared<Image>(pixels, type, w, h, d);
         onFinish(image);
     }
 }
@@ -88,9 +187,6 @@ JPEGFileImageProvider::~JPEGFileImageProvider()
     if (jerr) {
         delete jerr;
     }
-    if (pixels) {
-        free(pixels);
-    }
     if (scanline) {
         delete[] scanline;
     }
@@ -103,11 +199,35 @@ void JPEGFileImageProvider::onJPEGError(const std::string& error)
 }
 
 float JPEGFileImageProvider::getProgressPercentage() const {
-    if (cinfo) {
-        return (float) cinfo->output_scanline / cinfo->output_height;
-    } else {
-        return 0.f;
-    }
+    return progressPercentage;
+}
+
+void JPEGFileImageProvider::updateProgress()
+{
+    if (!cinfo->output_height)
+        return;
+    float p = (float) cinfo->output_scanline / cinfo->output_height;
+    // the preview is decoded much faster than the full image
+    if (previewScale > 1)
+        p *= 0.1f;
+    else if (hasPreview)
+        p = 0.1f + p * 0.9f;
+    progressPercentage = p;
+}
+
+// the preview is decoded at the smallest DCT scaling that keeps it at least this large
+#define JPEG_PREVIEW_SIZE 800
+
+void JPEGFileImageProvider::startDecompress()
+{
+    cinfo->scale_num = 1;
+    cinfo->scale_denom = previewScale;
+    jpeg_start_decompress(cinfo);
+    if (error) return;
+
+    image = std::make_shared<Image>(cinfo->output_width, cinfo->output_height, cinfo->output_components, SAMPLE_U8);
+    if (!scanline)
+        scanline = new unsigned char[cinfo->image_width*cinfo->output_components];
 }
 
 void JPEGFileImageProvider::progress()
@@ -133,26 +253,62 @@ void JPEGFileImageProvider::progress()
         jpeg_read_header(cinfo, TRUE);
         if (error) return;
 
-        jpeg_start_decompress(cinfo);
-        if (error) return;
+        // libjpeg can decode at 1/2, 1/4 or 1/8 of the size for a fraction of the cost
+        // so show such a preview while the full image is being decoded
+        size_t size = std::max(cinfo->image_width, cinfo->image_height);
+        if (isPreviewWanted() && size >= 2 * JPEG_PREVIEW_SIZE) {
+            previewScale = 8;
+            while (size / previewScale < JPEG_PREVIEW_SIZE)
+                previewScale /= 2;
+        }
 
-        pixels = (float*) malloc(sizeof(float)*cinfo->output_width*cinfo->output_height*cinfo->output_components);
-        scanline = new unsigned char[cinfo->output_width*cinfo->output_components];
+        startDecompress();
+        if (error) return;
     } else if (cinfo->output_scanline < cinfo->output_height) {
         jpeg_read_scanlines(cinfo, &scanline, 1);
         if (error) return;
         size_t rowwidth = cinfo->output_width*cinfo->output_components;
-        for (size_t j = 0; j < rowwidth; j++) {
-            pixels[(size_t)(cinfo->output_scanline-1)*rowwidth + j] = scanline[j];
-        }
+        uint8_t* row = (uint8_t*) image->samples + (size_t)(cinfo->output_scanline-1)*rowwidth;
+        std::copy(scanline, scanline + rowwidth, row);
+        // the reduced rows are published at once with their scale (see below),
+        // and the full resolution rows are not shown over the preview
+        if (!hasPreview && previewScale == 1)
+            onPartialImage(image, cinfo->output_scanline);
+        updateProgress();
+    } else if (previewScale > 1) {
+        jpeg_finish_decompress(cinfo);
+        if (error) return;
+
+        image->computeRange();
+        ImagePreview preview;
+        preview.image = image;
+        preview.scale = previewScale;
+        preview.w = cinfo->image_width;
+        preview.h = cinfo->image_height;
+        preview.rows = image->h;
+        preview.min = image->min;
+        preview.max = image->max;
+        onPreview(preview);
+        hasPreview = true;
+
+        // decode again, at full resolution
+        fseek(file, 0, SEEK_SET);
+        jpeg_stdio_src(cinfo, file);
+        if (error) return;
+
+        jpeg_read_header(cinfo, TRUE);
+        if (error) return;
+
+        previewScale = 1;
+        startDecompress();
+        if (error) return;
+        updateProgress();
     } else {
         jpeg_finish_decompress(cinfo);
         if (error) return;
 
-        std::shared_ptr<Image> image = std::make_shared<Image>(pixels,
-                               cinfo->output_width, cinfo->output_height, cinfo->output_components);
+        image->computeRange();
         onFinish(image);
-        pixels = nullptr;
     }
 }
 
@@ -168,15 +324,23 @@ struct PNGPrivate {
     int channels;
     int depth;
     uint32_t cur;
-    float* pixels;
+    std::shared_ptr<Image> image;
     png_bytep pngframe;
+    bool interlaced;
+    int pass;
+    // number of rows that can be shown, and whether the rows shown before have changed
+    size_t rows;
+    bool refined;
+    // last complete Adam7 pass
+    int donepass;
 
     uint32_t length;
     unsigned char* buffer;
 
     PNGPrivate(PNGFileImageProvider* provider)
         : provider(provider), file(nullptr), png_ptr(nullptr), info_ptr(nullptr),
-          height(0), pixels(nullptr), pngframe(nullptr),  buffer(nullptr)
+          height(0), pngframe(nullptr), interlaced(false), pass(0), rows(0), refined(false),
+          donepass(0), buffer(nullptr)
     {}
 
     ~PNGPrivate() {
@@ -186,9 +350,6 @@ struct PNGPrivate {
         if (pngframe) {
             free(pngframe);
         }
-        if (pixels) {
-            free(pixels);
-        }
         if (buffer) {
             free(buffer);
         }
@@ -203,11 +364,12 @@ struct PNGPrivate {
         height = png_get_image_height(png_ptr, info_ptr);
         channels = png_get_channels(png_ptr, info_ptr);
         depth = png_get_bit_depth(png_ptr, info_ptr);
-        pixels = (float*) malloc(sizeof(float)*width*height*channels);
+        image = std::make_shared<Image>(width, height, channels, depth == 16 ? SAMPLE_U16 : SAMPLE_U8);
         pngframe = (png_bytep) malloc(sizeof(*pngframe) * width*height*channels*depth/8);
 
         if (png_get_interlace_type(png_ptr, info_ptr) != PNG_INTERLACE_NONE) {
             png_set_interlace_handling(png_ptr);
+            interlaced = true;
         }
 
         png_start_read_image(png_ptr);
@@ -220,41 +382,84 @@ struct PNGPrivate {
             png_progressive_combine_row(png_ptr, pngframe+row_num*width*channels*depth/8, new_row);
         }
         cur = row_num;
+
+        if (!interlaced) {
+            convert(*image, row_num, row_num + 1, 0);
+            rows = row_num + 1;
+        } else if (pass != this->pass) {
+            // the previous Adam7 pass is complete, it is shown as blocks (see getPassPreview)
+            donepass = this->pass;
+            rows = height;
+            refined = true;
+            this->pass = pass;
+        }
     }
 
     void end_callback()
     {
     }
 
-    std::shared_ptr<Image> getImage()
+    template <int depth>
+    static unsigned getSample(const png_byte* frame, size_t i)
     {
         switch (depth) {
-            case 1:
-                for (size_t i = 0; i < width*height*channels/8; i++) {
-                    for (int b = 7; b >= 0; b--)
-                        pixels[i*8 + 7 - b] = !!(pngframe[i] & (1<<b));
-                }
-                break;
-            case 8:
-                for (size_t i = 0; i < width*height*channels; i++) {
-                    pixels[i] = *(pngframe + i);
-                }
-                break;
-            case 16:
-                for (size_t i = 0; i < width*height*channels; i++) {
-                    png_byte *b = (pngframe + i * 2);
-                    std::swap(b[0], b[1]);
-                    uint16_t sample = *(uint16_t *)b;
-                    pixels[i] = sample;
+            case 1: return !!(frame[i / 8] & (1 << (7 - i % 8)));
+            case 8: return frame[i];
+            default: return (frame[i * 2] << 8) | frame[i * 2 + 1];
+        }
+    }
+
+    // convert the rows [y0,y1) to the samples of the image, each pixel taking the value of the top-left
+    // pixel of its block, the size of the blocks depends on the last complete interlacing pass
+    template <int depth, typename T>
+    void convertRows(Image& dst, size_t y0, size_t y1, int lastpass)
+    {
+        static const size_t blockw[] = {8, 4, 4, 2, 2, 1, 1};
+        static const size_t blockh[] = {8, 8, 4, 4, 2, 2, 1};
+        size_t bw = interlaced ? blockw[lastpass] : 1;
+        size_t bh = interlaced ? blockh[lastpass] : 1;
+        T* pixels = (T*) dst.samples;
+        for (size_t y = y0; y < y1; y++) {
+            size_t sy = y / bh * bh;
+            for (size_t x = 0; x < width; x++) {
+                size_t sx = x / bw * bw;
+                for (int c = 0; c < channels; c++) {
+                    pixels[(y*width+x)*channels+c] = getSample<depth>(pngframe, (sy*width+sx)*channels+c);
                 }
-                break;
-            default:
-                return nullptr;
+            }
         }
+    }
 
-        auto img = std::make_shared<Image>(pixels, width, height, channels);
-        pixels = nullptr;
-        return img;
+    bool convert(Image& dst, size_t y0, size_t y1, int lastpass)
+    {
+        switch (depth) {
+            case 1: convertRows<1, uint8_t>(dst, y0, y1, lastpass); return true;
+            case 8: convertRows<8, uint8_t>(dst, y0, y1, lastpass); return true;
+            case 16: convertRows<16, uint16_t>(dst, y0, y1, lastpass); return true;
+            default: return false;
+        }
+    }
+
+    // the rows of a published image are read by the main thread, so each pass
+    // of an interlaced image is converted to a new image instead of 'image'
+    std::shared_ptr<Image> getPassPreview()
+    {
+        std::shared_ptr<Image> preview = std::make_shared<Image>(width, height, channels, image->type);
+        if (!convert(*preview, 0, height, donepass))
+            return nullptr;
+        return preview;
+    }
+
+    std::shared_ptr<Image> getImage()
+    {
+        if (!image || (depth != 1 && depth != 8 && depth != 16))
+            return nullptr;
+        // the rows of non-interlaced images are converted as they arrive
+        if (interlaced)
+            convert(*image, 0, height, 6);
+
+        image->computeRange();
+        return image;
     }
 };
 
@@ -267,6 +472,8 @@ float PNGFileImageProvider::getProgressPercentage() const
 {
     if (!p || p->height == 0)
         return 0.f;
+    if (p->interlaced)
+        return (p->pass + (float) p->cur / p->height) / 7.f;
     return (float) p->cur / p->height;
 }
 
@@ -354,6 +561,16 @@ void PNGFileImageProvider::progress()
         }
 
         png_process_data(p->png_ptr, p->info_ptr, p->buffer, read);
+
+        if (p->interlaced) {
+            std::shared_ptr<Image> preview;
+            if (p->refined && isPreviewWanted() && (preview = p->getPassPreview())) {
+                onPartialImage(preview, p->rows);
+            }
+            p->refined = false;
+        } else if (p->rows) {
+            onPartialImage(p->image, p->rows);
+        }
     } else {
         std::shared_ptr<Image> image = p->getImage();
         if (!image) {
@@ -373,19 +590,63 @@ void PNGFileImageProvider::onPNGError(const std::string& error)
 
 #include <tiffio.h>
 
+// convert n samples of type T to type D, reading every 'srcstride' samples
+// and writing every 'dststride' samples
+// the contiguous case is kept separate so that the compiler can vectorize it
+template <typename D, typename T>
+static void convert_samples(D* __restrict dst, size_t dststride,
+                            const T* __restrict src, size_t srcstride, size_t n)
+{
+    if (dststride == 1 && srcstride == 1) {
+        for (size_t i = 0; i < n; i++) {
+            dst[i] = src[i];
+        }
+    } else {
+        for (size_t i = 0; i < n; i++) {
+            dst[i*dststride] = src[i*srcstride];
+        }
+    }
+}
+
+// half floats are decoded, except into an image of half floats (SAMPLE_F16) where their bits are copied
+template <typename D>
+static void convert_half(D* __restrict dst, size_t dststride,
+                         const uint16_t* __restrict src, size_t srcstride, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        dst[i*dststride] = halfToFloat(src[i*srcstride]);
+    }
+}
+
+static void convert_half(uint16_t* __restrict dst, size_t dststride,
+                         const uint16_t* __restrict src, size_t srcstride, size_t n)
+{
+    convert_samples(dst, dststride, src, srcstride, n);
+}
+
 struct TIFFPrivate {
     TIFFFileImageProvider* provider;
     TIFF* tif;
     uint32_t w, h;
     uint16_t spp, bps, fmt;
-    float* data;
+    bool complex;
+    bool tiled;
+    bool planar;
+    // a chunk is either a tile or a strip (a strip is a tile as wide as the image)
+    uint32_t cw, ch;
+    uint32_t across, down;
+    uint32_t nchunks;
+    uint32_t curchunk;
+    // the image being filled
+    std::shared_ptr<Image> image;
     uint8_t* buf;
-    bool broken;
-    uint32_t curh;
-    int sls;
+    tmsize_t bufsize;
+    // index of the chunk currently decoded in 'buf'
+    uint32_t bufchunk;
 
     TIFFPrivate(TIFFFileImageProvider* provider)
-        : provider(provider), tif(nullptr), h(0), data(nullptr), buf(nullptr), curh(0)
+        : provider(provider), tif(nullptr), w(0), h(0), cw(0), ch(0), nchunks(0), curchunk(0),
+          buf(nullptr), bufsize(0), bufchunk(-1)
     {
     }
 
@@ -394,11 +655,359 @@ struct TIFFPrivate {
         if (tif) {
             TIFFClose(tif);
         }
-        if (data)
-            free(data);
         if (buf)
             free(buf);
     }
+
+    // read the size and the sample format of the current directory
+    bool readHeader()
+    {
+        int r = 0;
+        r += TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &w);
+        r += TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &h);
+
+        if (r != 2) return false;
+
+        r = TIFFGetField(tif, TIFFTAG_SAMPLESPERPIXEL, &spp);
+        if (!r)
+            spp=1;
+
+        r = TIFFGetField(tif, TIFFTAG_BITSPERSAMPLE, &bps);
+        if (!r)
+            bps=1;
+
+        r = TIFFGetField(tif, TIFFTAG_SAMPLEFORMAT, &fmt);
+        if (!r)
+            fmt = SAMPLEFORMAT_UINT;
+
+        complex = fmt == SAMPLEFORMAT_COMPLEXINT || fmt == SAMPLEFORMAT_COMPLEXIEEEFP;
+        if (complex) {
+            spp *= 2;
+            bps /= 2;
+        }
+        if (fmt == SAMPLEFORMAT_COMPLEXINT)
+            fmt = SAMPLEFORMAT_INT;
+        if (fmt == SAMPLEFORMAT_COMPLEXIEEEFP)
+            fmt = SAMPLEFORMAT_IEEEFP;
+
+        uint16_t planarity;
+        r = TIFFGetField(tif, TIFFTAG_PLANARCONFIG, &planarity);
+        if (r != 1) planarity = PLANARCONFIG_CONTIG;
+        planar = planarity == PLANARCONFIG_SEPARATE && spp > 1;
+        return true;
+    }
+
+    // the scanline size does not match when the samples are not
+    // stored as reported (eg. subsampled YCbCr), iio knows how to handle these
+    bool isConsistent() const
+    {
+        size_t scanline_size = (size_t) w * (planar ? 1 : spp) * bps / 8;
+        return (size_t) TIFFScanlineSize(tif) == scanline_size;
+    }
+
+    // read the geometry of the tiles or strips
+    bool readLayout()
+    {
+        tiled = TIFFIsTiled(tif);
+        if (tiled) {
+            TIFFGetField(tif, TIFFTAG_TILEWIDTH, &cw);
+            TIFFGetField(tif, TIFFTAG_TILELENGTH, &ch);
+            bufsize = TIFFTileSize(tif);
+            nchunks = TIFFNumberOfTiles(tif);
+        } else {
+            uint32_t rps;
+            if (!TIFFGetField(tif, TIFFTAG_ROWSPERSTRIP, &rps) || rps > h)
+                rps = h;
+            cw = w;
+            ch = rps;
+            bufsize = TIFFStripSize(tif);
+            nchunks = TIFFNumberOfStrips(tif);
+        }
+        if (!cw || !ch)
+            return false;
+        across = (w + cw - 1) / cw;
+        down = (h + ch - 1) / ch;
+        return nchunks == across * down * (planar ? spp : 1);
+    }
+
+    bool isSupported() const
+    {
+        switch (fmt) {
+            case SAMPLEFORMAT_UINT:
+            case SAMPLEFORMAT_INT:
+                return bps == 8 || bps == 16 || bps == 32;
+            case SAMPLEFORMAT_IEEEFP:
+                return bps == 16 || bps == 32 || bps == 64;
+            default:
+                return false;
+        }
+    }
+
+    // 8 and 16 bits unsigned samples and half floats are kept as such, the others are converted to float
+    SampleType getSampleType() const
+    {
+        if (fmt == SAMPLEFORMAT_UINT && bps == 8)
+            return SAMPLE_U8;
+        if (fmt == SAMPLEFORMAT_UINT && bps == 16)
+            return SAMPLE_U16;
+        if (fmt == SAMPLEFORMAT_IEEEFP && bps == 16)
+            return SAMPLE_F16;
+        return SAMPLE_F32;
+    }
+
+    // convert n samples, 'srcstride' is expressed in samples
+    template <typename D>
+    void convertSamples(D* dst, size_t dststride, const uint8_t* src, size_t srcstride, size_t n)
+    {
+#define CONVERT(T) convert_samples(dst, dststride, (const T*) src, srcstride, n)
+        if (fmt == SAMPLEFORMAT_UINT) {
+            if (bps == 8) CONVERT(uint8_t);
+            else if (bps == 16) CONVERT(uint16_t);
+            else CONVERT(uint32_t);
+        } else if (fmt == SAMPLEFORMAT_INT) {
+            if (bps == 8) CONVERT(int8_t);
+            else if (bps == 16) CONVERT(int16_t);
+            else CONVERT(int32_t);
+        } else {
+            if (bps == 16) convert_half(dst, dststride, (const uint16_t*) src, srcstride, n);
+            else if (bps == 32) CONVERT(float);
+            else CONVERT(double);
+        }
+#undef CONVERT
+    }
+
+    // convert one row of a chunk, at the right place in the image
+    template <typename D>
+    void convertRow(const uint8_t* src, size_t x, size_t y, size_t plane, size_t n)
+    {
+        D* dst = (D*) image->samples + (y*w + x)*spp + plane;
+        if (planar) {
+            convertSamples(dst, spp, src, 1, n);
+        } else {
+            convertSamples(dst, 1, src, 1, n * spp);
+        }
+    }
+
+    size_t getChunkRowSize() const
+    {
+        return (size_t) cw * (planar ? 1 : spp) * bps / 8;
+    }
+
+    // decode a tile or a strip into 'buf'
+    bool decodeChunk(uint32_t chunk)
+    {
+        if (chunk == bufchunk)
+            return true;
+        tmsize_t r;
+        if (tiled) {
+            r = TIFFReadEncodedTile(tif, chunk, buf, bufsize);
+        } else {
+            r = TIFFReadEncodedStrip(tif, chunk, buf, bufsize);
+        }
+        bufchunk = r < 0 ? -1 : chunk;
+        return r >= 0;
+    }
+
+    // read and convert the next tile or strip
+    bool readChunk()
+    {
+        uint32_t perplane = across * down;
+        uint32_t plane = curchunk / perplane;
+        uint32_t cx = (curchunk % perplane) % across * cw;
+        uint32_t cy = (curchunk % perplane) / across * ch;
+
+        if (!decodeChunk(curchunk))
+            return false;
+
+        size_t rowsize = getChunkRowSize();
+        size_t cols = std::min(cw, w - cx);
+        size_t rows = std::min(ch, h - cy);
+        for (size_t y = 0; y < rows; y++) {
+            switch (image->type) {
+                case SAMPLE_U8: convertRow<uint8_t>(buf + y * rowsize, cx, cy + y, plane, cols); break;
+                case SAMPLE_U16: convertRow<uint16_t>(buf + y * rowsize, cx, cy + y, plane, cols); break;
+                case SAMPLE_F16: convertRow<uint16_t>(buf + y * rowsize, cx, cy + y, plane, cols); break;
+                default: convertRow<float>(buf + y * rowsize, cx, cy + y, plane, cols); break;
+            }
+        }
+        curchunk++;
+        return true;
+    }
+
+    // number of complete rows of the image, the planes of planar images are read one after the other
+    size_t getValidRows() const
+    {
+        uint32_t first = planar ? (spp - 1) * across * down : 0;
+        if (curchunk <= first)
+            return 0;
+        return std::min((size_t) (curchunk - first) / across * ch, (size_t) h);
+    }
+
+    // read one pixel every 'scale' pixels of the area starting at (x,y)
+    // each tile or strip crossed by the area is decoded once, and its samples are spread over the rows
+    bool readArea(size_t x, size_t y, size_t rw, size_t rh, size_t scale, float* out)
+    {
+        if (!rw || !rh)
+            return true;
+        size_t bytes = bps / 8;
+        size_t pixelsize = (planar ? 1 : spp) * bytes;
+        size_t rowsize = getChunkRowSize();
+        size_t perplane = across * down;
+        size_t nplanes = planar ? spp : 1;
+        // index of the first output sample at or after the source coordinate 'a'
+        auto first = [scale](size_t origin, size_t a) {
+            return a <= origin ? 0 : (a - origin + scale - 1) / scale;
+        };
+        size_t cy0 = y / ch, cy1 = (y + (rh - 1) * scale) / ch;
+        size_t cx0 = x / cw, cx1 = (x + (rw - 1) * scale) / cw;
+        for (size_t plane = 0; plane < nplanes; plane++) {
+            for (size_t cy = cy0; cy <= cy1; cy++) {
+                size_t j0 = first(y, cy * ch);
+                size_t j1 = std::min(rh, first(y, std::min((cy + 1) * ch, (size_t) h)));
+                if (j0 >= j1)
+                    continue;
+                for (size_t cx = cx0; cx <= cx1; cx++) {
+                    size_t i0 = first(x, cx * cw);
+                    size_t i1 = std::min(rw, first(x, std::min((cx + 1) * cw, (size_t) w)));
+                    if (i0 >= i1)
+                        continue;
+                    if (!decodeChunk(plane * perplane + cy * across + cx))
+                        return false;
+                    size_t n = i1 - i0;
+                    size_t sx = x + i0 * scale;
+                    for (size_t j = j0; j < j1; j++) {
+                        size_t sy = y + j * scale;
+                        const uint8_t* src = buf + (sy % ch) * rowsize + (sx % cw) * pixelsize;
+                        float* dst = out + (j * rw + i0) * spp + plane;
+                        if (planar) {
+                            convertSamples(dst, spp, src, scale, n);
+                        } else {
+                            for (size_t c = 0; c < spp; c++) {
+                                convertSamples(dst + c, spp, src + c * bytes, scale * spp, n);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        return true;
+    }
+};
+
+// opens a reduced resolution version of the image of 'full', returns its reduction factor or 0
+static size_t open_tiff_level(TIFFPrivate* level, const TIFFPrivate* full)
+{
+    if (!level->tif || !level->readHeader())
+        return 0;
+    if (level->spp != full->spp || level->bps != full->bps || level->fmt != full->fmt
+        || level->complex != full->complex || !level->isConsistent() || !level->readLayout())
+        return 0;
+    if (!level->w || !level->h || level->w >= full->w)
+        return 0;
+
+    // only keep the levels reduced by a power of two
+    size_t r = 1;
+    while (r * level->w < full->w && r < 1<<20)
+        r *= 2;
+    if ((full->w + r - 1) / r != level->w || (full->h + r - 1) / r != level->h)
+        return 0;
+
+    level->buf = (uint8_t*) malloc(level->bufsize);
+    if (!level->buf)
+        return 0;
+    return r;
+}
+
+class TIFFTileSource : public TileSource {
+    // full resolution first, then the reduced resolution subfiles by increasing reduction
+    std::vector<TIFFPrivate*> levels;
+    std::vector<size_t> reductions;
+    std::mutex lock;
+
+    void addLevel(TIFFPrivate* level) {
+        size_t r = open_tiff_level(level, levels[0]);
+        if (!r || std::find(reductions.begin(), reductions.end(), r) != reductions.end()) {
+            delete level;
+            return;
+        }
+        size_t i = std::upper_bound(reductions.begin(), reductions.end(), r) - reductions.begin();
+        levels.insert(levels.begin() + i, level);
+        reductions.insert(reductions.begin() + i, r);
+    }
+
+public:
+    TIFFTileSource(TIFFPrivate* p, const std::string& filename) {
+        levels.push_back(p);
+        reductions.push_back(1);
+
+        // reduced resolution images stored as sub-directories (eg. OME-TIFF)
+        uint16_t nsub;
+        toff_t* offsets;
+        if (TIFFGetField(p->tif, TIFFTAG_SUBIFD, &nsub, &offsets)) {
+            std::vector<toff_t> subifds(offsets, offsets + nsub);
+            for (toff_t off : subifds) {
+                TIFFPrivate* level = new TIFFPrivate(nullptr);
+                level->tif = TIFFOpen(filename.c_str(), "rm");
+                if (level->tif && !TIFFSetSubDirectory(level->tif, off)) {
+                    TIFFClose(level->tif);
+                    level->tif = nullptr;
+                }
+                addLevel(level);
+            }
+        }
+
+        // reduced resolution images stored as the following directories (eg. GeoTIFF overviews)
+        tdir_t ndirs = TIFFNumberOfDirectories(p->tif);
+        for (tdir_t d = 1; d < ndirs; d++) {
+            TIFFPrivate* level = new TIFFPrivate(nullptr);
+            level->tif = TIFFOpen(filename.c_str(), "rm");
+            uint32_t type = 0;
+            if (level->tif && (!TIFFSetDirectory(level->tif, d)
+                               || !TIFFGetField(level->tif, TIFFTAG_SUBFILETYPE, &type)
+                               || !(type & FILETYPE_REDUCEDIMAGE))) {
+                TIFFClose(level->tif);
+                level->tif = nullptr;
+            }
+            addLevel(level);
+        }
+    }
+
+    virtual ~TIFFTileSource() {
+        for (auto level : levels) {
+            delete level;
+        }
+    }
+
+    virtual bool read(size_t x, size_t y, size_t w, size_t h, size_t scale, float* out) {
+        std::lock_guard<std::mutex> _lock(lock);
+
+        // use the coarsest level that still has the requested resolution
+        size_t i = 0;
+        while (i + 1 < levels.size() && scale % reductions[i + 1] == 0)
+            i++;
+        TIFFPrivate* level = levels[i];
+        size_t r = reductions[i];
+        x /= r;
+        y /= r;
+        scale /= r;
+
+        // the reduced image can be smaller than expected by a pixel, replicate its borders
+        size_t lw = std::min(w, (level->w - x + scale - 1) / scale);
+        size_t lh = std::min(h, (level->h - y + scale - 1) / scale);
+        if (lw == w && lh == h)
+            return level->readArea(x, y, w, h, scale, out);
+
+        std::vector<float> tmp(lw * lh * level->spp);
+        if (!level->readArea(x, y, lw, lh, scale, &tmp[0]))
+            return false;
+        for (size_t j = 0; j < h; j++) {
+            for (size_t i = 0; i < w; i++) {
+                const float* src = &tmp[(std::min(j, lh - 1) * lw + std::min(i, lw - 1)) * level->spp];
+                std::copy(src, src + level->spp, out + (j * w + i) * level->spp);
+            }
+        }
+        return true;
+    }
 };
 
 TIFFFileImageProvider::~TIFFFileImageProvider()
@@ -410,8 +1019,8 @@ TIFFFileImageProvider::~TIFFFileImageProvider()
 
 float TIFFFileImageProvider::getProgressPercentage() const
 {
-    if (p && p->h)
-        return (float) p->curh / p->h;
+    if (p && p->nchunks)
+        return (float) p->curchunk / p->nchunks;
     return 0.f;
 }
 
@@ -422,68 +1031,48 @@ void TIFFFileImageProvider::progress()
         p->tif = TIFFOpen(filename.c_str(), "rm");
         if (!p->tif) return onFinish(makeError("cannot read tiff " + filename));
 
-        int r = 0;
-        r += TIFFGetField(p->tif, TIFFTAG_IMAGEWIDTH, &p->w);
-        r += TIFFGetField(p->tif, TIFFTAG_IMAGELENGTH, &p->h);
-
-        if (r != 2) return onFinish(makeError("can not read tiff of unknown size"));
+        if (!p->readHeader()) return onFinish(makeError("can not read tiff of unknown size"));
 
-        r = TIFFGetField(p->tif, TIFFTAG_SAMPLESPERPIXEL, &p->spp);
-        if (!r)
-            p->spp=1;
-
-        r = TIFFGetField(p->tif, TIFFTAG_BITSPERSAMPLE, &p->bps);
-        if (!r)
-            p->bps=1;
-
-        r = TIFFGetField(p->tif, TIFFTAG_SAMPLEFORMAT, &p->fmt);
-        if (!r)
-            p->fmt = SAMPLEFORMAT_UINT;
-
-        if (p->fmt == SAMPLEFORMAT_COMPLEXINT || p->fmt == SAMPLEFORMAT_COMPLEXIEEEFP) {
-            p->spp *= 2;
-            p->bps /= 2;
-        }
-        if (p->fmt == SAMPLEFORMAT_COMPLEXINT)
-            p->fmt = SAMPLEFORMAT_INT;
-        if (p->fmt == SAMPLEFORMAT_COMPLEXIEEEFP)
-            p->fmt = SAMPLEFORMAT_IEEEFP;
-
-        uint16_t planarity;
-        r = TIFFGetField(p->tif, TIFFTAG_PLANARCONFIG, &planarity);
-        if (r != 1) planarity = PLANARCONFIG_CONTIG;
-        p->broken = planarity == PLANARCONFIG_SEPARATE;
-
-        uint32_t scanline_size = (p->w * p->spp * p->bps)/8;
-        int rbps = (p->bps/8) ? (p->bps/8) : 1;
-        p->sls = TIFFScanlineSize(p->tif);
-        if ((int)scanline_size != p->sls)
-            fprintf(stderr, "scanline_size,sls = %d,%d\n", (int)scanline_size, p->sls);
-        //assert((int)scanline_size == sls);
-        if (!p->broken)
-            assert((int)scanline_size == p->sls);
-        assert((int)scanline_size >= p->sls);
-        p->data = (float*) malloc(p->w * p->h * p->spp * rbps);
-        p->buf = (uint8_t*) malloc(scanline_size);
-        p->curh = 0;
-
-        if (TIFFIsTiled(p->tif) || p->fmt != SAMPLEFORMAT_IEEEFP || p->broken || rbps != sizeof(float)) {
+        if (!p->isSupported() || !p->isConsistent() || (p->complex && p->planar)) {
             std::shared_ptr<Image> image = load_from_iio(filename);
             if (!image) {
                 onFinish(makeError("iio: cannot load image '" + filename + "'"));
             } else {
                 onFinish(image);
             }
+            return;
+        }
+
+        if (!p->readLayout())
+            return onFinish(makeError("invalid tiff layout " + filename));
+
+        p->buf = (uint8_t*) malloc(p->bufsize);
+        if (!p->buf)
+            return onFinish(makeError("cannot allocate memory for tiff " + filename));
+
+        // huge images are read on demand, one tile at a time
+        if (getSampleSize(p->getSampleType()) * p->w * p->h * p->spp > gTiledLoadingThresholdMB * 1000000) {
+            p->provider = nullptr;
+            std::shared_ptr<TileSource> source = std::make_shared<TIFFTileSource>(p, filename);
+            std::shared_ptr<Image> image = std::make_shared<Image>(source, p->w, p->h, p->spp);
+            p = nullptr;
+            return onFinish(image);
+        }
+
+        p->image = std::make_shared<Image>(p->w, p->h, p->spp, p->getSampleType());
+        if (!p->image->samples)
+            return onFinish(makeError("cannot allocate memory for tiff " + filename));
+        p->curchunk = 0;
+    } else if (p->curchunk < p->nchunks) {
+        if (!p->readChunk()) {
+            onFinish(makeError("error reading tiff " + std::string(p->tiled ? "tile " : "strip ")
+                               + std::to_string(p->curchunk)));
+            return;
         }
-    } else if (p->curh < p->h) {
-        int r = TIFFReadScanline(p->tif, p->buf, p->curh);
-        if (r < 0) onFinish(makeError("error reading tiff row " + std::to_string(p->curh)));
-        memcpy(p->data + p->curh * p->sls/sizeof(float), p->buf, p->sls);
-        p->curh++;
+        onPartialImage(p->image, p->getValidRows());
     } else {
-        std::shared_ptr<Image> image = std::make_shared<Image>(p->data, p->w, p->h, p->spp);
-        onFinish(image);
-        p->data = nullptr;
+        p->image->computeRange();
+        onFinish(p->image);
     }
 }
 
@@ -535,7 +1124,7 @@ void RAWFileImageProvider::progress()
         int w = processor->imgdata.sizes.raw_width;
         int h = processor->imgdata.sizes.raw_height;
         int d = 1;
-        float* data = (float*) malloc(sizeof(float)*w*h*d);
+        uint16_t* data = (uint16_t*) malloc(sizeof(uint16_t)*w*h*d);
 
         for (int y = 0; y < h; y++) {
             for (int x = 0; x < w; x++) {
@@ -543,7 +1132,7 @@ void RAWFileImageProvider::progress()
             }
         }
 
-        std::shared_ptr<Image> image = std::make_shared<Image>(data, w, h, d);
+        std::shared_ptr<Image> image = std::make_shared<Image>(data, SAMPLE_U16, w, h, d);
         onFinish(image);
     }
 end:
@@ -551,6 +1140,33 @@ end:
 #endif
 }
 
+void TileImageProvider::progress()
+{
+    size_t span = TILE_SIZE * scale;
+    size_t x = tx * span;
+    size_t y = ty * span;
+    if (x >= image->w || y >= image->h) {
+        onFinish(makeError("invalid tile"));
+        return;
+    }
+    size_t w = std::min(span, image->w - x);
+    size_t h = std::min(span, image->h - y);
+    w = (w + scale - 1) / scale;
+    h = (h + scale - 1) / scale;
+
+    float* pixels = (float*) malloc(sizeof(float) * w * h * image->c);
+    if (!pixels) {
+        onFinish(makeError("cannot allocate memory for tile " + std::to_string(tx) + "," + std::to_string(ty)));
+        return;
+    }
+    if (!image->tilesource->read(x, y, w, h, scale, pixels)) {
+        free(pixels);
+        onFinish(makeError("cannot read tile " + std::to_string(tx) + "," + std::to_string(ty)));
+        return;
+    }
+    onFinish(std::make_shared<Image>(pixels, w, h, image->c));
+}
+
 void EditedImageProvider::progress() {
     for (auto p : providers) {
         if (!p->isLoaded()) {
@@ -563,6 +1179,10 @@ void EditedImageProvider::progress() {
         Result result = p->getResult();
         if (result.has_value()) {
             std::shared_ptr<Image> image = result.value();
+            if (image->isTiled()) {
+                onFinish(makeError("cannot edit tiled images"));
+                return;
+            }
             image->usedBy.insert(key);
             images.push_back(image);
         } else {
@@ -8,6 +8,9 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <mutex>
+#include <atomic>
+#include <limits>
 
 #include "expected.hpp"
 
@@ -34,6 +37,10 @@ public:
 private:
     bool loaded;
     Result result;
+    std::atomic<bool> previewWanted;
+    mutable std::mutex previewLock;
+    ImagePreview preview;
+    float partialMin, partialMax;
 
 protected:
     void onFinish(const Result& res) {
@@ -50,11 +57,37 @@ protected:
         return nonstd::make_unexpected<typename Result::error_type>(std::move(e));
     }
 
+    void onPreview(const ImagePreview& preview) {
+        std::lock_guard<std::mutex> _lock(previewLock);
+        this->preview = preview;
+    }
+
+    bool isPreviewWanted() const {
+        return previewWanted;
+    }
+
+    // publish the image being decoded, whose first 'rows' rows are valid
+    // 'refined' indicates that the rows published previously have changed
+    void onPartialImage(const std::shared_ptr<Image>& image, size_t rows, bool refined=false);
+
 public:
-    ImageProvider() : loaded(false) {
+    ImageProvider() : loaded(false), previewWanted(false),
+                      partialMin(std::numeric_limits<float>::max()),
+                      partialMax(std::numeric_limits<float>::lowest()) {
         LOG("create provider")
     }
 
+    // ask the provider to publish a preview of the image before the end of the loading
+    // only done for the displayed images, so that prefetching does not pay for it
+    virtual void requestPreview() {
+        previewWanted = true;
+    }
+
+    virtual ImagePreview getPreview() const {
+        std::lock_guard<std::mutex> _lock(previewLock);
+        return preview;
+    }
+
     virtual ~ImageProvider() {
     }
 
@@ -74,10 +107,11 @@ class CacheImageProvider : public ImageProvider {
     std::string key;
     std::function<std::shared_ptr<ImageProvider>()> get;
     std::shared_ptr<ImageProvider> provider;
+    bool keep;
 
 public:
     CacheImageProvider(const std::string& key, std::function<std::shared_ptr<ImageProvider>()> get)
-        : key(key), get(get) {
+        : key(key), get(get), keep(true) {
         if (ImageCache::has(key)) {
             onFinish(ImageCache::get(key));
         } else if (ImageCache::Error::has(key)) {
@@ -90,6 +124,22 @@ public:
     virtual ~CacheImageProvider() {
     }
 
+    // the image is not stored in the cache once loaded, used when reading all the frames of a collection
+    void dontKeep() {
+        keep = false;
+    }
+
+    virtual void requestPreview() {
+        if (provider)
+            provider->requestPreview();
+    }
+
+    virtual ImagePreview getPreview() const {
+        if (provider)
+            return provider->getPreview();
+        return ImagePreview();
+    }
+
     virtual float getProgressPercentage() const {
         if (ImageCache::has(key)) {
             return 1.f;
@@ -105,11 +155,13 @@ public:
             provider->progress();
             if (provider->isLoaded()) {
                 Result result = provider->getResult();
-                if (result.has_value()) {
-                    std::shared_ptr<Image> image = result.value();
-                    ImageCache::store(key, image);
-                } else {
-                    ImageCache::Error::store(key, result.error());
+                if (keep) {
+                    if (result.has_value()) {
+                        std::shared_ptr<Image> image = result.value();
+                        ImageCache::store(key, image);
+                    } else {
+                        ImageCache::Error::store(key, result.error());
+                    }
                 }
                 onFinish(result);
             }
@@ -162,15 +214,24 @@ public:
 class JPEGFileImageProvider : public FileImageProvider {
     struct jpeg_decompress_struct* cinfo;
     FILE* file;
-    float* pixels;
+    std::shared_ptr<Image> image;
     unsigned char* scanline;
     bool error;
     struct jpeg_error_mgr* jerr;
+    // reduction of the preview being decoded, 1 when decoding the full image
+    size_t previewScale;
+    bool hasPreview;
+    // written by the loading thread, read by getProgressPercentage()
+    std::atomic<float> progressPercentage;
+
+    void startDecompress();
+    void updateProgress();
 
 public:
     JPEGFileImageProvider(const std::string& filename)
         : FileImageProvider(filename), cinfo(nullptr), file(nullptr),
-          pixels(nullptr), scanline(nullptr), error(false), jerr(nullptr)
+          scanline(nullptr), error(false), jerr(nullptr),
+          previewScale(1), hasPreview(false), progressPercentage(0.f)
     {
     }
 
@@ -237,6 +298,28 @@ public:
     static bool canOpen(const std::string& filename);
 };
 
+// loads a tile of a tiled image (see tiles.hpp)
+class TileImageProvider : public ImageProvider {
+    std::shared_ptr<Image> image;
+    size_t tx, ty;
+    size_t scale;
+
+public:
+    TileImageProvider(const std::shared_ptr<Image>& image, size_t tx, size_t ty, size_t scale)
+        : image(image), tx(tx), ty(ty), scale(scale)
+    {
+    }
+
+    virtual ~TileImageProvider() {
+    }
+
+    virtual float getProgressPercentage() const {
+        return 0.f;
+    }
+
+    virtual void progress();
+};
+
 #include "editors.hpp"
 class EditedImageProvider : public ImageProvider {
     EditType edittype;
@@ -10,6 +10,7 @@
 #include "ImageCollection.hpp"
 #include "globals.hpp"
 #include "events.hpp"
+#include "Texture.hpp"
 
 Player::Player() {
     static int id = 0;
@@ -117,6 +118,11 @@ void Player::displaySettings()
     ImGui::SameLine(); ImGui::ShowHelpMarker("Change the Frame Per Second rate");
     ImGui::DragIntRange2("Bounds", &currentMinFrame, &currentMaxFrame, 1.f, minFrame, maxFrame);
     ImGui::SameLine(); ImGui::ShowHelpMarker("Change the bounds of the playback");
+    ImGui::Checkbox("Asynchronous uploads", &gUsePBO);
+    ImGui::SameLine(); ImGui::ShowHelpMarker("Upload the images to the GPU through pixel buffer objects (USE_PBO)");
+    ImGui::Text("Frame time: %.1f ms, uploads: %.1f ms", texture_get_frame_time(), texture_get_upload_time());
+    ImGui::Text("Startup time: %.0f ms", gStartupTime);
+    ImGui::SameLine(); ImGui::ShowHelpMarker("From the launch to the first frame showing an image or a preview, the shaders are cached to shorten it (SHADER_CACHE)");
 }
 
 void Player::checkShortcuts()
@@ -0,0 +1,160 @@
+#include <algorithm>
+
+#include "Image.hpp"
+#include "Pyramid.hpp"
+
+// the last level is the first whose size fits in this many pixels
+#define PYRAMID_MIN_SIZE 256
+
+// average of the blocks of f*f pixels, the blocks on the right and bottom borders can be smaller
+static std::shared_ptr<Image> reduce(const Image& src, size_t f)
+{
+    size_t w = (src.w + f - 1) / f;
+    size_t h = (src.h + f - 1) / f;
+    size_t c = src.c;
+    // the levels keep the sample type of the image
+    std::shared_ptr<Image> level = std::make_shared<Image>(w, h, c, src.type);
+
+    std::vector<float> row(src.w * c);
+    std::vector<float> sum(w * c);
+    std::vector<float> out(w * c);
+    for (size_t y = 0; y < h; y++) {
+        size_t y0 = y * f;
+        size_t y1 = std::min(y0 + f, src.h);
+        std::fill(sum.begin(), sum.end(), 0.f);
+        for (size_t sy = y0; sy < y1; sy++) {
+            src.readSamples(sy * src.w * c, src.w * c, &row[0]);
+            for (size_t sx = 0; sx < src.w; sx++) {
+                for (size_t d = 0; d < c; d++) {
+                    sum[sx / f * c + d] += row[sx * c + d];
+                }
+            }
+        }
+        for (size_t x = 0; x < w; x++) {
+            size_t n = (std::min((x + 1) * f, src.w) - x * f) * (y1 - y0);
+            for (size_t d = 0; d < c; d++) {
+                out[x * c + d] = sum[x * c + d] / n;
+            }
+        }
+        level->writeSamples(y * w * c, w * c, &out[0]);
+    }
+
+    level->computeRange();
+    return level;
+}
+
+// returns false if the image is too small for a pyramid, the levels are kept if it is the same image
+bool Pyramid::setImage(const std::shared_ptr<Image>& image)
+{
+    if (image == this->image.lock())
+        return true;
+    if (image->isTiled() || std::max(image->w, image->h) <= PYRAMID_MIN_SIZE)
+        return false;
+
+    this->image = image;
+    size_t nlevels = 0;
+    for (size_t s = std::max(image->w, image->h); s > PYRAMID_MIN_SIZE; s = (s + 1) / 2) {
+        nlevels++;
+    }
+    levels.assign(nlevels, nullptr);
+    first = nlevels;
+    return true;
+}
+
+void Pyramid::request(const std::shared_ptr<Image>& image)
+{
+    std::lock_guard<std::mutex> _lock(lock);
+    if (!setImage(image) || first == 0)
+        return;
+    first = 0;
+    loaded = false;
+}
+
+void Pyramid::requestCoarsest(const std::shared_ptr<Image>& image)
+{
+    std::lock_guard<std::mutex> _lock(lock);
+    if (!setImage(image) || first < levels.size())
+        return;
+    first = levels.size() - 1;
+    loaded = false;
+}
+
+float Pyramid::getProgressPercentage() const
+{
+    std::lock_guard<std::mutex> _lock(lock);
+    if (loaded) return 1.f;
+    if (first >= levels.size()) return 0.f;
+    size_t done = 0;
+    for (size_t i = first; i < levels.size(); i++) {
+        done += levels[i] != nullptr;
+    }
+    return (float) done / (levels.size() - first);
+}
+
+void Pyramid::progress()
+{
+    std::shared_ptr<Image> image = this->image.lock();
+    if (!image) {
+        std::lock_guard<std::mutex> _lock(lock);
+        loaded = true;
+        return;
+    }
+
+    // the first missing level is computed from the finest level below it
+    std::shared_ptr<Image> src = image;
+    size_t f = 2;
+    size_t i;
+    {
+        std::lock_guard<std::mutex> _lock(lock);
+        for (i = 0; i < levels.size() && (i < first || levels[i]); i++) {
+            if (levels[i]) {
+                src = levels[i];
+                f = 2;
+            } else {
+                f *= 2;
+            }
+        }
+        if (i == levels.size()) {
+            loaded = true;
+            return;
+        }
+    }
+
+    // computed outside of the lock, getLevel() can still be used meanwhile
+    std::shared_ptr<Image> level = reduce(*src, f);
+
+    std::lock_guard<std::mutex> _lock(lock);
+    if (image != this->image.lock())
+        return;
+    levels[i] = level;
+    loaded = std::all_of(levels.begin() + first, levels.end(),
+                         [](const std::shared_ptr<Image>& l) { return l != nullptr; });
+}
+
+std::shared_ptr<Image> Pyramid::getLevel(size_t& scale) const
+{
+    std::lock_guard<std::mutex> _lock(lock);
+    std::shared_ptr<Image> level;
+    size_t found = 1;
+    size_t s = 1;
+    for (size_t i = 0; i < levels.size() && s * 2 <= scale; i++) {
+        s *= 2;
+        if (levels[i]) {
+            level = levels[i];
+            found = s;
+        }
+    }
+    scale = found;
+    return level;
+}
+
+size_t Pyramid::getMemorySize() const
+{
+    std::lock_guard<std::mutex> _lock(lock);
+    size_t size = 0;
+    for (auto& level : levels) {
+        if (level)
+            size += level->getMemorySize();
+    }
+    return size;
+}
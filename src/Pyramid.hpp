@@ -0,0 +1,47 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <mutex>
+
+#include "Progressable.hpp"
+
+struct Image;
+
+// downsampled versions of an image, used when zoomed out
+// the level i is reduced by a factor 2^(i+1) using box averages
+class Pyramid : public Progressable {
+private:
+    bool loaded;
+    mutable std::mutex lock;
+    std::weak_ptr<Image> image;
+    // null for the levels that are not computed yet
+    std::vector<std::shared_ptr<Image>> levels;
+    // the levels from this one to the last are wanted
+    size_t first;
+
+    bool setImage(const std::shared_ptr<Image>& image);
+
+public:
+    Pyramid() : loaded(true), first(0) {}
+
+    // all the levels
+    void request(const std::shared_ptr<Image>& image);
+    // only the last level, for example to be shown while the image is uploaded
+    void requestCoarsest(const std::shared_ptr<Image>& image);
+
+    float getProgressPercentage() const;
+
+    bool isLoaded() const {
+        return loaded;
+    }
+
+    void progress();
+
+    // returns the coarsest level reduced by at most 'scale', or null if there is none yet
+    // 'scale' is updated to the reduction factor of the returned level
+    std::shared_ptr<Image> getLevel(size_t& scale) const;
+
+    // the levels are accounted for in the memory of the image (see Image::getMemorySize)
+    size_t getMemorySize() const;
+};
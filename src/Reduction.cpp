@@ -0,0 +1,327 @@
+#include <cmath>
+#include <limits>
+#include <thread>
+#include <algorithm>
+
+#include "Image.hpp"
+#include "ImageProvider.hpp"
+#include "Reduction.hpp"
+
+static std::mutex requestsLock;
+static std::vector<std::weak_ptr<Reduction>> requests;
+
+std::shared_ptr<Reduction> ImageCollection::getReduction() const
+{
+    std::lock_guard<std::mutex> _lock(requestsLock);
+    if (!reduction) {
+        reduction = std::make_shared<Reduction>((ImageCollection*) this);
+        // forget the reductions that were reset or whose collection is gone
+        requests.erase(std::remove_if(requests.begin(), requests.end(),
+                                      [](const std::weak_ptr<Reduction>& r) { return r.expired(); }),
+                       requests.end());
+        requests.push_back(reduction);
+    }
+    return reduction;
+}
+
+void ImageCollection::resetReduction() const
+{
+    std::lock_guard<std::mutex> _lock(requestsLock);
+    reduction = nullptr;
+}
+
+std::shared_ptr<Reduction> reduction_get_next_request()
+{
+    std::lock_guard<std::mutex> _lock(requestsLock);
+    for (auto& r : requests) {
+        std::shared_ptr<Reduction> reduction = r.lock();
+        if (reduction && !reduction->isLoaded()) {
+            return reduction;
+        }
+    }
+    return nullptr;
+}
+
+Reduction::Reduction(ImageCollection* collection)
+    : loaded(false), collection(collection), length(collection->getLength()), curframe(0),
+      w(0), h(0), c(0),
+      globalMin(std::numeric_limits<float>::max()), globalMax(std::numeric_limits<float>::lowest()),
+      histogramMin(0), histogramWidth(0), nbins(256)
+{
+    if (!length) {
+        error = "empty sequence";
+        loaded = true;
+    }
+}
+
+float Reduction::getProgressPercentage() const
+{
+    std::lock_guard<std::mutex> _lock(lock);
+    if (loaded) return 1.f;
+    return (float) curframe / length;
+}
+
+std::string Reduction::getError() const
+{
+    std::lock_guard<std::mutex> _lock(lock);
+    return error;
+}
+
+int Reduction::getFramesDone() const
+{
+    std::lock_guard<std::mutex> _lock(lock);
+    return curframe;
+}
+
+std::shared_ptr<Image> Reduction::getResult(int result) const
+{
+    std::lock_guard<std::mutex> _lock(lock);
+    if (result < 0 || result >= NUM_RESULTS)
+        return nullptr;
+    return results[result];
+}
+
+bool Reduction::getRange(float& min, float& max) const
+{
+    std::lock_guard<std::mutex> _lock(lock);
+    min = globalMin;
+    max = globalMax;
+    return min <= max;
+}
+
+std::vector<std::vector<size_t>> Reduction::getHistogram(float& min, float& width) const
+{
+    std::lock_guard<std::mutex> _lock(lock);
+    min = histogramMin;
+    width = histogramWidth;
+    return histogram;
+}
+
+// the first frame gives the bins, they are then merged by pairs until [lo,hi] fits
+void Reduction::growHistogram(float lo, float hi)
+{
+    if (histogramWidth == 0) {
+        histogramMin = lo;
+        histogramWidth = hi > lo ? (hi - lo) / (nbins - 1) : 1.f;
+        histogram.assign(c, std::vector<size_t>(nbins));
+        return;
+    }
+    while (lo < histogramMin || hi >= histogramMin + nbins * histogramWidth) {
+        // growing downwards, the current bins become the upper half
+        size_t offset = 0;
+        if (lo < histogramMin) {
+            offset = nbins;
+            histogramMin -= nbins * histogramWidth;
+        }
+        for (auto& bins : histogram) {
+            std::vector<size_t> merged(nbins);
+            for (int i = 0; i < nbins; i++) {
+                merged[(offset + i) / 2] += bins[i];
+            }
+            bins = merged;
+        }
+        histogramWidth *= 2;
+    }
+}
+
+// the accumulators are only accessed by the loading thread, the lock protects the published values
+void Reduction::accumulate(const Image& image)
+{
+    {
+        std::lock_guard<std::mutex> _lock(lock);
+        growHistogram(image.min, image.max);
+        globalMin = std::min(globalMin, image.min);
+        globalMax = std::max(globalMax, image.max);
+    }
+
+    // bands of rows are reduced by different threads, they share nothing but their histogram is merged
+    size_t nthreads = std::max(1u, std::thread::hardware_concurrency());
+    nthreads = std::min(nthreads, h);
+    std::vector<std::vector<size_t>> histograms(nthreads, std::vector<size_t>(c * nbins));
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < nthreads; t++) {
+        size_t y0 = h * t / nthreads;
+        size_t y1 = h * (t + 1) / nthreads;
+        threads.emplace_back([&, y0, y1, t]() {
+            size_t n = w * c;
+            std::vector<float> row(n);
+            size_t* hist = histograms[t].data();
+            float f = 1.f / histogramWidth;
+            for (size_t y = y0; y < y1; y++) {
+                image.readSamples(y * n, n, row.data());
+                size_t o = y * n;
+                for (size_t i = 0; i < n; i++) {
+                    float v = row[i];
+                    if (!std::isfinite(v))
+                        continue;
+                    size_t j = o + i;
+                    uint32_t k = ++count[j];
+                    float delta = v - mean[j];
+                    mean[j] += delta / k;
+                    m2[j] += delta * (v - mean[j]);
+                    min[j] = std::min(min[j], v);
+                    max[j] = std::max(max[j], v);
+
+                    int bin = (v - histogramMin) * f;
+                    bin = std::max(0, std::min(nbins - 1, bin));
+                    hist[(i % c) * nbins + bin]++;
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    std::lock_guard<std::mutex> _lock(lock);
+    for (auto& hist : histograms) {
+        for (size_t d = 0; d < c; d++) {
+            for (int b = 0; b < nbins; b++) {
+                histogram[d][b] += hist[d * nbins + b];
+            }
+        }
+    }
+}
+
+void Reduction::finish()
+{
+    size_t n = w * h * c;
+    std::shared_ptr<Image> images[NUM_RESULTS];
+    for (int r = 0; r < NUM_RESULTS; r++) {
+        images[r] = std::make_shared<Image>(w, h, c);
+    }
+    float* means = (float*) images[MEAN]->samples;
+    float* variances = (float*) images[VARIANCE]->samples;
+    float* mins = (float*) images[MIN]->samples;
+    float* maxs = (float*) images[MAX]->samples;
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    for (size_t i = 0; i < n; i++) {
+        if (!count[i]) {
+            means[i] = variances[i] = mins[i] = maxs[i] = nan;
+            continue;
+        }
+        means[i] = mean[i];
+        variances[i] = m2[i] / count[i];
+        mins[i] = min[i];
+        maxs[i] = max[i];
+    }
+    for (auto& image : images) {
+        image->computeRange();
+    }
+
+    std::vector<float>().swap(mean);
+    std::vector<float>().swap(m2);
+    std::vector<float>().swap(min);
+    std::vector<float>().swap(max);
+    std::vector<uint32_t>().swap(count);
+
+    std::lock_guard<std::mutex> _lock(lock);
+    for (int r = 0; r < NUM_RESULTS; r++) {
+        results[r] = images[r];
+    }
+}
+
+void Reduction::progress()
+{
+    if (loaded)
+        return;
+
+    if (!provider) {
+        provider = collection->getImageProvider(curframe);
+        auto cached = std::dynamic_pointer_cast<CacheImageProvider>(provider);
+        if (cached) {
+            cached->dontKeep();
+        }
+    }
+    if (!provider->isLoaded()) {
+        provider->progress();
+        if (!provider->isLoaded())
+            return;
+    }
+
+    ImageProvider::Result result = provider->getResult();
+    provider = nullptr;
+
+    std::string err;
+    std::shared_ptr<Image> image;
+    if (!result.has_value()) {
+        err = result.error();
+    } else {
+        image = result.value();
+        if (image->isTiled()) {
+            err = "the frames are too large to be reduced";
+        } else if (curframe == 0) {
+            w = image->w;
+            h = image->h;
+            c = image->c;
+            size_t n = w * h * c;
+            mean.assign(n, 0.f);
+            m2.assign(n, 0.f);
+            min.assign(n, std::numeric_limits<float>::max());
+            max.assign(n, std::numeric_limits<float>::lowest());
+            count.assign(n, 0);
+        } else if (image->w != w || image->h != h || image->c != c) {
+            err = "the frames have different sizes";
+        }
+    }
+    if (!err.empty()) {
+        std::lock_guard<std::mutex> _lock(lock);
+        error = "frame " + std::to_string(curframe + 1) + ": " + err;
+        loaded = true;
+        return;
+    }
+
+    accumulate(*image);
+    if (curframe + 1 == length) {
+        finish();
+    }
+    std::lock_guard<std::mutex> _lock(lock);
+    curframe++;
+    loaded = curframe == length;
+}
+
+class ReductionImageProvider : public ImageProvider {
+    std::shared_ptr<Reduction> reduction;
+    int index;
+
+public:
+    ReductionImageProvider(std::shared_ptr<Reduction> reduction, int index)
+        : reduction(reduction), index(index) {
+    }
+
+    float getProgressPercentage() const {
+        return reduction->getProgressPercentage();
+    }
+
+    // the reduction is progressed by the loading thread of the displayed images
+    void progress() {
+        if (!reduction->isLoaded()) {
+            reduction->progress();
+            return;
+        }
+        std::shared_ptr<Image> image = reduction->getResult(index);
+        if (image) {
+            onFinish(image);
+        } else {
+            onFinish(makeError("reduction: " + reduction->getError()));
+        }
+    }
+};
+
+ReductionImageCollection::ReductionImageCollection(ImageCollection* parent)
+    : parent(parent)
+{
+    const char* results[] = {"mean", "variance", "min", "max"};
+    for (const char* r : results) {
+        std::string name = r;
+        if (parent->getLength()) {
+            name += " of " + parent->getFilename(0);
+        }
+        names.push_back(name);
+    }
+}
+
+std::shared_ptr<ImageProvider> ReductionImageCollection::getImageProvider(int index) const
+{
+    return std::make_shared<ReductionImageProvider>(parent->getReduction(), index);
+}
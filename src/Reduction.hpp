@@ -0,0 +1,104 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+
+#include "Progressable.hpp"
+#include "ImageCollection.hpp"
+
+struct Image;
+
+// statistics over all the frames of a collection, computed in the background
+// the frames are read one by one, reduced in a single pass and not kept in the cache
+class Reduction : public Progressable {
+public:
+    // frames of the virtual sequence showing the reduction
+    enum Result {
+        MEAN,
+        VARIANCE,
+        MIN,
+        MAX,
+        NUM_RESULTS,
+    };
+
+private:
+    bool loaded;
+    mutable std::mutex lock;
+    ImageCollection* collection;
+    std::shared_ptr<ImageProvider> provider;
+    int length;
+    int curframe;
+    std::string error;
+
+    // per sample accumulators (Welford), the non-finite samples are not counted
+    size_t w, h, c;
+    std::vector<float> mean, m2, min, max;
+    std::vector<uint32_t> count;
+    std::shared_ptr<Image> results[NUM_RESULTS];
+
+    float globalMin, globalMax;
+    // the bins are doubled in width when the range grows, so that a sample always falls into a single bin
+    float histogramMin, histogramWidth;
+    std::vector<std::vector<size_t>> histogram;
+
+    void growHistogram(float lo, float hi);
+    void accumulate(const Image& image);
+    void finish();
+
+public:
+    const int nbins;
+
+    Reduction(ImageCollection* collection);
+
+    float getProgressPercentage() const;
+
+    bool isLoaded() const {
+        return loaded;
+    }
+
+    void progress();
+
+    std::string getError() const;
+    int getFramesDone() const;
+    // null until the reduction is done
+    std::shared_ptr<Image> getResult(int result) const;
+    bool getRange(float& min, float& max) const;
+    // per band, the bin i covers [min+i*width, min+(i+1)*width)
+    std::vector<std::vector<size_t>> getHistogram(float& min, float& width) const;
+};
+
+// returns a reduction which is not done and was requested recently, to be progressed by the loading thread
+std::shared_ptr<Reduction> reduction_get_next_request();
+
+// mean, variance, min and max of the frames of 'parent', available once the reduction is done
+class ReductionImageCollection : public ImageCollection {
+    ImageCollection* parent;
+    std::vector<std::string> names;
+
+public:
+    ReductionImageCollection(ImageCollection* parent);
+
+    virtual ~ReductionImageCollection() {
+    }
+
+    const std::string& getFilename(int index) const {
+        return names[index];
+    }
+
+    std::string getKey(int index) const {
+        return "reduction:" + parent->getKey(0) + ":" + std::to_string(index);
+    }
+
+    int getLength() const {
+        return Reduction::NUM_RESULTS;
+    }
+
+    std::shared_ptr<ImageProvider> getImageProvider(int index) const;
+
+    void onFileReload(const std::string& filename) {
+        parent->onFileReload(filename);
+        parent->resetReduction();
+    }
+};
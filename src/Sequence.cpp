@@ -8,6 +8,7 @@
 #include <sstream>
 #include <algorithm>
 #include <iterator>
+#include <thread>
 #include <sys/types.h> // stat
 #include <sys/stat.h> // stat
 
@@ -22,6 +23,7 @@
 #include "globals.hpp"
 #include "SVG.hpp"
 #include "Histogram.hpp"
+#include "Reduction.hpp"
 #include "editors.hpp"
 #include "shaders.hpp"
 #include "EditGUI.hpp"
@@ -142,13 +144,37 @@ static void recursive_collect(std::vector<std::string>& filenames, std::string g
 
 void Sequence::loadFilenames() {
     std::vector<std::string> filenames;
-    recursive_collect(filenames, std::string(glob.c_str()));
+    ImageCollection* col = nullptr;
+
+    // reduce:<n> shows the mean, variance, min and max over the frames of the n-th sequence
+    if (!strncmp(glob.c_str(), "reduce:", 7)) {
+        error.clear();
+        int id = atoi(glob.c_str() + 7) - 1;
+        if (id < 0 || id >= gSequences.size() || gSequences[id] == this) {
+            error = glob + ": invalid sequence";
+        } else if (!gSequences[id]->collection) {
+            // the sequences are loaded in order, a later one has no collection yet
+            error = glob + ": sequence " + std::to_string(id + 1) + " is not loaded yet";
+        } else {
+            col = new ReductionImageCollection(gSequences[id]->collection);
+            for (int i = 0; i < col->getLength(); i++) {
+                filenames.push_back(col->getFilename(i));
+            }
+        }
+        if (!error.empty()) {
+            fprintf(stderr, "%s\n", error.c_str());
+        }
+    } else {
+        recursive_collect(filenames, std::string(glob.c_str()));
 
-    if (filenames.empty() && !strcmp(glob.c_str(), "-")) {
-        filenames.push_back("-");
+        if (filenames.empty() && !strcmp(glob.c_str(), "-")) {
+            filenames.push_back("-");
+        }
     }
 
-    ImageCollection* col = buildImageCollectionFromFilenames(filenames);
+    if (!col) {
+        col = buildImageCollectionFromFilenames(filenames);
+    }
     this->collection = col;
     this->uneditedCollection = col;
 
@@ -197,7 +223,17 @@ void Sequence::tick()
         forgetImage();
     }
 
+    if (imageprovider && !imageprovider->isLoaded()) {
+        ImagePreview p = imageprovider->getPreview();
+        if (p.image && (p.image != preview.image || p.rows != preview.rows
+                        || p.refinements != preview.refinements)) {
+            preview = p;
+            gActive = std::max(gActive, 2);
+        }
+    }
+
     if (imageprovider && imageprovider->isLoaded()) {
+        preview = ImagePreview();
         ImageProvider::Result result = imageprovider->getResult();
         if (result.has_value()) {
             image = result.value();
@@ -213,14 +249,17 @@ void Sequence::tick()
         if (image) {
             auto mode = gSmoothHistogram ? Histogram::SMOOTH : Histogram::EXACT;
             image->histogram->request(image, mode);
+            if (colormap && colormap->autoContrast) {
+                colormap->followImage(image);
+            }
         }
     }
 
-    if (image && colormap && !colormap->initialized) {
-        colormap->autoCenterAndRadius(image->min, image->max);
-
+    // the preview can be used to initialize the colormap until the image is loaded
+    std::shared_ptr<Image> img = image ? image : preview.image;
+    if (img && colormap && !colormap->initialized) {
         if (!colormap->shader) {
-            switch (image->c) {
+            switch (img->c) {
                 case 1:
                     colormap->shader = getShader("gray");
                     break;
@@ -234,7 +273,16 @@ void Sequence::tick()
                     break;
             }
         }
-        colormap->initialized = true;
+
+        // the range of tiled images is only known once some tiles are loaded
+        // and the range of a preview only covers its decoded rows,
+        // so follow it until the image is loaded
+        float min = image ? image->min : preview.min;
+        float max = image ? image->max : preview.max;
+        if (min <= max) {
+            colormap->autoCenterAndRadius(min, max);
+            colormap->initialized = image != nullptr;
+        }
     }
 }
 
@@ -242,20 +290,175 @@ void Sequence::forgetImage()
 {
     LOG("forget image, was=" << image << " provider=" << imageprovider);
     image = nullptr;
+    preview = ImagePreview();
     if (player && collection) {
         int desiredFrame = getDesiredFrameIndex();
         imageprovider = collection->getImageProvider(desiredFrame - 1);
+        imageprovider->requestPreview();
         loadedFrame = desiredFrame;
     }
     LOG("forget image, new provider=" << imageprovider);
 }
 
+// split the rows [y0,y1) between threads, fn(ya, yb, thread index) is called for each band of rows
+template <typename F>
+static void runOnRows(size_t nthreads, size_t y0, size_t y1, F fn)
+{
+    std::vector<std::thread> threads;
+    size_t step = (y1 - y0 + nthreads - 1) / nthreads;
+    for (size_t t = 0; t < nthreads; t++) {
+        size_t ya = y0 + t * step;
+        size_t yb = std::min(y1, ya + step);
+        if (ya >= yb)
+            break;
+        threads.emplace_back(fn, ya, yb, t);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+static size_t getThreadCount(size_t rows)
+{
+    return std::max((size_t) 1, std::min((size_t) std::thread::hardware_concurrency(), rows));
+}
+
+// the last bin ends at 'max', non-finite values are out of [min,max] and ignored
+static inline int getQuantileBin(float v, float min, float max, float f)
+{
+    if (!(v >= min && v <= max))
+        return -1;
+    return (v - min) * f;
+}
+
+static float getQuantileBinFactor(float min, float max)
+{
+    return max > min ? (QUANTILE_BINS - 1) / (max - min) : 0.f;
+}
+
+// fills counts with the number of samples of the region per bin and returns the number of finite samples
+static size_t countQuantileBins(const Image& img, ImRect region, const std::vector<int>& channels,
+                                float min, float max, std::vector<size_t>& counts)
+{
+    size_t x0 = region.Min.x;
+    size_t n = ((size_t) region.Max.x - x0) * img.c;
+    float f = getQuantileBinFactor(min, max);
+    size_t nthreads = getThreadCount(region.GetHeight());
+
+    std::vector<std::vector<size_t>> partial(nthreads, std::vector<size_t>(QUANTILE_BINS));
+    runOnRows(nthreads, region.Min.y, region.Max.y, [&](size_t y0, size_t y1, size_t t) {
+        std::vector<float> row(n);
+        std::vector<int> bins(n);
+        size_t* hist = partial[t].data();
+        for (size_t y = y0; y < y1; y++) {
+            img.readSamples((y*img.w + x0)*img.c, n, row.data());
+            // the bins of the whole row first, so that this loop vectorizes
+            for (size_t i = 0; i < n; i++) {
+                bins[i] = getQuantileBin(row[i], min, max, f);
+            }
+            for (size_t i = 0; i < n; i += img.c) {
+                for (int d : channels) {
+                    int b = bins[i + d];
+                    if (b >= 0)
+                        hist[b]++;
+                }
+            }
+        }
+    });
+
+    counts.assign(QUANTILE_BINS, 0);
+    size_t total = 0;
+    for (auto& p : partial) {
+        for (size_t b = 0; b < QUANTILE_BINS; b++) {
+            counts[b] += p[b];
+            total += p[b];
+        }
+    }
+    return total;
+}
+
+// bin containing the sample of the given rank, and the rank of this sample within the bin
+static size_t findQuantileBin(const std::vector<size_t>& counts, size_t& rank)
+{
+    size_t b = 0;
+    while (b < counts.size() - 1 && rank >= counts[b]) {
+        rank -= counts[b];
+        b++;
+    }
+    return b;
+}
+
+// the samples are assumed to be spread evenly inside their bin,
+// the error is at most the width of a bin, (max-min)/65535
+static float findApproximateQuantile(const Sequence::QuantileHistogram& qh, size_t rank)
+{
+    float f = getQuantileBinFactor(qh.min, qh.max);
+    if (f == 0.f)
+        return qh.min;
+    size_t b = findQuantileBin(qh.counts, rank);
+    float v = qh.min + (b + (rank + .5f) / qh.counts[b]) / f;
+    return std::min(std::max(v, qh.min), qh.max);
+}
+
+// only the samples of the two bins containing the quantiles are gathered and partially sorted
+static void findExactQuantiles(const Image& img, const Sequence::QuantileHistogram& qh,
+                               const size_t ranks[2], float values[2])
+{
+    float f = getQuantileBinFactor(qh.min, qh.max);
+    if (f == 0.f) {
+        values[0] = values[1] = qh.min;
+        return;
+    }
+    size_t inbin[2] = {ranks[0], ranks[1]};
+    int bins[2] = {
+        (int) findQuantileBin(qh.counts, inbin[0]),
+        (int) findQuantileBin(qh.counts, inbin[1]),
+    };
+
+    size_t x0 = qh.region.Min.x;
+    size_t n = ((size_t) qh.region.Max.x - x0) * img.c;
+    size_t nthreads = getThreadCount(qh.region.GetHeight());
+    std::vector<std::array<std::vector<float>, 2>> partial(nthreads);
+    runOnRows(nthreads, qh.region.Min.y, qh.region.Max.y, [&](size_t y0, size_t y1, size_t t) {
+        std::vector<float> row(n);
+        for (size_t y = y0; y < y1; y++) {
+            img.readSamples((y*img.w + x0)*img.c, n, row.data());
+            for (size_t i = 0; i < n; i += img.c) {
+                for (int d : qh.channels) {
+                    float v = row[i + d];
+                    int b = getQuantileBin(v, qh.min, qh.max, f);
+                    for (int k = 0; k < 2; k++) {
+                        if (b == bins[k])
+                            partial[t][k].push_back(v);
+                    }
+                }
+            }
+        }
+    });
+
+    for (int k = 0; k < 2; k++) {
+        std::vector<float> all;
+        for (auto& p : partial) {
+            all.insert(all.end(), p[k].begin(), p[k].end());
+        }
+        std::nth_element(all.begin(), all.begin() + inbin[k], all.end());
+        values[k] = all[inbin[k]];
+    }
+}
+
 void Sequence::autoScaleAndBias(ImVec2 p1, ImVec2 p2, float quantile)
 {
     std::shared_ptr<Image> img = getCurrentImage();
     if (!img)
         return;
 
+    // only the range of the loaded tiles is known for tiled images
+    if (img->isTiled()) {
+        if (img->min <= img->max)
+            colormap->autoCenterAndRadius(img->min, img->max);
+        return;
+    }
+
     BandIndices bands = colormap->bands;
     float low = std::numeric_limits<float>::max();
     float high = std::numeric_limits<float>::lowest();
@@ -281,14 +484,13 @@ void Sequence::autoScaleAndBias(ImVec2 p1, ImVec2 p2, float quantile)
             low = img->min;
             high = img->max;
         } else {
-            const float* data = (const float*) img->pixels;
             for (int d = 0; d < 3; d++) {
                 int b = bands[d];
                 if (b >= img->c)
                     continue;
                 for (int y = p1.y; y < p2.y; y++) {
                     for (int x = p1.x; x < p2.x; x++) {
-                        float v = data[b + img->c*(x+y*img->w)];
+                        float v = img->getSample(b + img->c*(x+y*img->w));
                         if (std::isfinite(v)) {
                             low = std::min(low, v);
                             high = std::max(high, v);
@@ -298,53 +500,47 @@ void Sequence::autoScaleAndBias(ImVec2 p1, ImVec2 p2, float quantile)
             }
         }
     } else {
-        std::vector<float> all;
-        const float* data = (const float*) img->pixels;
         if (norange) {
-            if (img->c <= 3 && bands == BANDS_DEFAULT) {
-                // fast path
-                all = std::vector<float>(data, data+img->w*img->h*img->c);
-            } else {
-                for (int d = 0; d < 3; d++) {
-                    int b = bands[d];
-                    if (b >= img->c)
-                        continue;
-                    for (int y = 0; y < img->h; y++) {
-                        for (int x = 0; x < img->w; x++) {
-                            float v = data[b + img->c*(x+y*img->w)];
-                            all.push_back(v);
-                        }
-                    }
-                }
-            }
+            p1 = ImVec2(0, 0);
+            p2 = ImVec2(img->w, img->h);
+        }
+        std::vector<int> channels;
+        for (int d = 0; d < 3; d++) {
+            int b = bands[d];
+            if (b < img->c && std::find(channels.begin(), channels.end(), b) == channels.end())
+                channels.push_back(b);
+        }
+        if (channels.empty() || !(img->min <= img->max))
+            return;
+
+        QuantileHistogram& qh = quantileHistogram;
+        ImRect region(p1, p2);
+        if (qh.image.lock() != img || !(qh.region == region) || qh.channels != channels
+            || qh.min != img->min || qh.max != img->max) {
+            qh.image = img;
+            qh.region = region;
+            qh.channels = channels;
+            qh.min = img->min;
+            qh.max = img->max;
+            qh.total = countQuantileBins(*img, region, channels, qh.min, qh.max, qh.counts);
+        }
+        if (!qh.total)
+            return;
+
+        size_t ranks[2] = {
+            (size_t) (quantile * qh.total),
+            std::min((size_t) ((1 - quantile) * qh.total), qh.total - 1),
+        };
+        float values[2];
+        if (gExactQuantiles) {
+            findExactQuantiles(*img, qh, ranks, values);
         } else {
-            if (img->c <= 3 && bands == BANDS_DEFAULT) {
-                // fast path
-                for (int y = p1.y; y < p2.y; y++) {
-                    const float* start = &data[0 + img->c*((int)p1.x+y*img->w)];
-                    const float* end = &data[0 + img->c*((int)p2.x+y*img->w)];
-                    all.insert(all.end(), start, end);
-                }
-            } else {
-                for (int d = 0; d < 3; d++) {
-                    int b = bands[d];
-                    if (b >= img->c)
-                        continue;
-                    for (int y = p1.y; y < p2.y; y++) {
-                        for (int x = p1.x; x < p2.x; x++) {
-                            float v = data[b + img->c*(x+y*img->w)];
-                            all.push_back(v);
-                        }
-                    }
-                }
+            for (int i = 0; i < 2; i++) {
+                values[i] = findApproximateQuantile(qh, ranks[i]);
             }
         }
-        all.erase(std::remove_if(all.begin(), all.end(),
-                                 [](float x){return !std::isfinite(x);}),
-                  all.end());
-        std::sort(all.begin(), all.end());
-        low = all[quantile*all.size()];
-        high = all[(1-quantile)*all.size()];
+        low = values[0];
+        high = values[1];
     }
 
     colormap->autoCenterAndRadius(low, high);
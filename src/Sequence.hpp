@@ -10,6 +10,7 @@
 #include "imgui_internal.h"
 
 #include "editors.hpp"
+#include "Image.hpp"
 
 struct View;
 struct Player;
@@ -20,6 +21,8 @@ class ImageCollection;
 class ImageProvider;
 class EditGUI;
 
+#define QUANTILE_BINS (1<<16)
+
 struct Sequence {
     std::string ID;
     std::string glob;
@@ -39,11 +42,24 @@ struct Sequence {
     Colormap* colormap;
     std::shared_ptr<ImageProvider> imageprovider;
     std::shared_ptr<Image> image;
+    // shown while the image is being loaded
+    ImagePreview preview;
     std::string error;
 
     ImageCollection* uneditedCollection;
     EditGUI* editGUI;
 
+    // number of samples per bin of the last region saturated by autoScaleAndBias,
+    // so that the next saturation levels do not read the image again
+    struct QuantileHistogram {
+        std::weak_ptr<Image> image;
+        ImRect region;
+        std::vector<int> channels;
+        float min, max;
+        std::vector<size_t> counts;
+        size_t total;
+    } quantileHistogram;
+
     Sequence();
     ~Sequence();
 
@@ -1,5 +1,12 @@
 #include <string>
 #include <vector>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#ifndef WINDOWS
+#include <sys/stat.h>
+#endif
 
 #include <GL/gl3w.h>
 #include "globals.hpp"
@@ -7,6 +14,8 @@
 
 #include "Shader.hpp"
 
+#define S(...) #__VA_ARGS__
+
 static const char* getGLError(GLenum error)
 {
 #define casereturn(x) case x: return #x
@@ -33,20 +42,135 @@ static const char* getGLError(GLenum error)
     } \
 }
 
+static Shader* bound = nullptr;
+
 Shader::Shader()
+    : program(0), failed(false)
 {
     static int id = 0;
     id++;
     ID = "Shader " + std::to_string(id);
+    memset(&uniforms, -1, sizeof(uniforms));
+    currentScale.fill(std::nanf(""));
+    currentBias.fill(std::nanf(""));
+    currentLayered = 0;
 }
 
 Shader::~Shader()
 {
+    if (bound == this) {
+        bound = nullptr;
+    }
     if (program) {
         glDeleteProgram(program);
     }
 }
 
+// the compiled programs are cached in $XDG_CACHE_HOME/vpv (or $HOME/.cache/vpv),
+// under a hash of their sources and of the driver, so that the next startups skip the compilation
+static uint64_t hashString(const std::string& str, uint64_t h=1469598103934665603ull)
+{
+    // FNV-1a, stable across builds unlike std::hash
+    for (unsigned char c : str) {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+static std::string getBinaryCachePath(const std::string& sources)
+{
+#ifdef WINDOWS
+    return "";
+#else
+    if (!gShaderCache || !glGetProgramBinary || !glProgramBinary)
+        return "";
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    if (formats <= 0)
+        return "";
+
+    std::string dir;
+    if (getenv("XDG_CACHE_HOME")) {
+        dir = getenv("XDG_CACHE_HOME");
+    } else if (getenv("HOME")) {
+        dir = std::string(getenv("HOME")) + "/.cache";
+    } else {
+        return "";
+    }
+    mkdir(dir.c_str(), 0755);
+    dir += "/vpv";
+    mkdir(dir.c_str(), 0755);
+
+    std::string driver;
+    for (GLenum e : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+        const char* s = (const char*) glGetString(e);
+        driver += s ? s : "";
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long) hashString(sources, hashString(driver)));
+    return dir + "/" + name;
+#endif
+}
+
+// returns 0 if the file does not exist or if the driver does not accept the binary anymore
+static GLuint loadProgramBinary(const std::string& path)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file)
+        return 0;
+    std::vector<char> data;
+    char buffer[1<<14];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        data.insert(data.end(), buffer, buffer + n);
+    }
+    fclose(file);
+    if (data.size() <= sizeof(GLenum))
+        return 0;
+
+    GLenum format;
+    memcpy(&format, &data[0], sizeof(GLenum));
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, format, &data[sizeof(GLenum)], data.size() - sizeof(GLenum));
+    // an unknown format is an error, which should not be reported
+    while (glGetError() != GL_NO_ERROR) {
+    }
+    GLint status;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (status == GL_FALSE) {
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+static void saveProgramBinary(const std::string& path, GLuint program)
+{
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+    std::vector<char> data(sizeof(GLenum) + length);
+    GLenum format;
+    glGetProgramBinary(program, length, NULL, &format, &data[sizeof(GLenum)]);
+    GLDEBUG();
+    memcpy(&data[0], &format, sizeof(GLenum));
+
+    // written to a temporary file first, so that another instance never reads a partial file
+    std::string tmp = path + ".tmp";
+    FILE* file = fopen(tmp.c_str(), "wb");
+    if (!file)
+        return;
+    bool ok = fwrite(&data[0], 1, data.size(), file) == data.size();
+    ok &= fclose(file) == 0;
+    if (ok) {
+        rename(tmp.c_str(), path.c_str());
+    } else {
+        remove(tmp.c_str());
+    }
+}
+
 bool Shader::compile()
 {
     GLDEBUG();
@@ -56,6 +180,40 @@ bool Shader::compile()
 
     std::string header = "#version 330 core\n#ifdef GL_ES\nprecision mediump float;\n#endif\n";
     std::string headedCodeVertex = header + codeVertex;
+    // the images are uploaded as layers of 4 channels, when other bands than the first three
+    // are displayed, the samples of the texture come from the layers holding these bands
+    // (see SetLayersCallback), so that the shaders can keep sampling 'tex'
+    std::string layers = S(
+        uniform int vpv_layered;
+        uniform sampler2D vpv_layer0;
+        uniform sampler2D vpv_layer1;
+        uniform sampler2D vpv_layer2;
+        uniform ivec3 vpv_components;
+        vec4 vpv_texture(sampler2D s, vec2 uv)
+        {
+            if (vpv_layered == 0)
+                return texture(s, uv);
+            vec4 p = vec4(0.0, 0.0, 0.0, 1.0);
+            if (vpv_components.x >= 0) p.x = texture(vpv_layer0, uv)[vpv_components.x];
+            if (vpv_components.y >= 0) p.y = texture(vpv_layer1, uv)[vpv_components.y];
+            if (vpv_components.z >= 0) p.z = texture(vpv_layer2, uv)[vpv_components.z];
+            return p;
+        }
+    ) "\n#define texture(s, uv) vpv_texture(s, uv)\n";
+    std::string headedCodeFragment = header + layers + codeFragment;
+
+    std::string cachePath = getBinaryCachePath(headedCodeVertex + headedCodeFragment);
+    if (!cachePath.empty()) {
+        GLuint cached = loadProgramBinary(cachePath);
+        if (cached) {
+            if (program)
+                glDeleteProgram(program);
+            program = cached;
+            resolveUniforms();
+            return true;
+        }
+    }
+
     const char* codeVertexPtr = headedCodeVertex.c_str();
     GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
     glShaderSource(vertexShader, 1, &codeVertexPtr, NULL);
@@ -73,7 +231,6 @@ bool Shader::compile()
         }
     }
 
-    std::string headedCodeFragment = header + codeFragment;
     const char* codeFragmentPtr = headedCodeFragment.c_str();
     GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
     glShaderSource(fragmentShader, 1, &codeFragmentPtr, NULL);
@@ -90,9 +247,14 @@ bool Shader::compile()
         }
     }
 
+    if (program)
+        glDeleteProgram(program);
     program = glCreateProgram();
     glAttachShader(program, vertexShader);
     glAttachShader(program, fragmentShader);
+    if (!cachePath.empty()) {
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
     glLinkProgram(program);
 
     glDetachShader(program, vertexShader);
@@ -101,16 +263,73 @@ bool Shader::compile()
     glDeleteShader(vertexShader);
     glDeleteShader(fragmentShader);
     GLDEBUG();
+
+    glGetProgramiv(program, GL_LINK_STATUS, &result);
+    if (result == GL_TRUE && !cachePath.empty()) {
+        saveProgramBinary(cachePath, program);
+    }
+
+    resolveUniforms();
     return true;
 }
 
+void Shader::resolveUniforms()
+{
+    uniforms.tex = glGetUniformLocation(program, "tex");
+    uniforms.transform = glGetUniformLocation(program, "v_transform");
+    uniforms.scale = glGetUniformLocation(program, "scale");
+    uniforms.bias = glGetUniformLocation(program, "bias");
+    uniforms.time = glGetUniformLocation(program, "time");
+    uniforms.layered = glGetUniformLocation(program, "vpv_layered");
+    uniforms.layers[0] = glGetUniformLocation(program, "vpv_layer0");
+    uniforms.layers[1] = glGetUniformLocation(program, "vpv_layer1");
+    uniforms.layers[2] = glGetUniformLocation(program, "vpv_layer2");
+    uniforms.components = glGetUniformLocation(program, "vpv_components");
+    GLDEBUG();
+
+    // the texture units never change (see SetLayersCallback)
+    GLint previous;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &previous);
+    glUseProgram(program);
+    glUniform1i(uniforms.tex, 0);
+    for (int i = 0; i < 3; i++) {
+        glUniform1i(uniforms.layers[i], 1 + i);
+    }
+    glUniform1i(uniforms.layered, 0);
+    glUseProgram(previous);
+    GLDEBUG();
+    if (bound == this) {
+        bound = nullptr;
+    }
+
+    // not a possible value, so that the first values are sent
+    currentScale.fill(std::nanf(""));
+    currentBias.fill(std::nanf(""));
+    currentLayered = 0;
+}
+
 void Shader::bind()
 {
+    if (bound == this)
+        return;
+    // the shaders are compiled when they are first used, not all at startup
+    if (!program && !failed) {
+        failed = !compile();
+    }
     GLDEBUG();
     glUseProgram(program);
-    GLuint loc = glGetUniformLocation(program, "tex");
-    glUniform1i(loc, 0);
     GLDEBUG();
+    bound = this;
+}
+
+void Shader::forgetBinding()
+{
+    bound = nullptr;
+}
+
+Shader* Shader::getBound()
+{
+    return bound;
 }
 
 void Shader::setParameter(const std::string& name, float a, float b, float c)
@@ -123,3 +342,26 @@ void Shader::setParameter(const std::string& name, float a, float b, float c)
     GLDEBUG();
 }
 
+void Shader::setScaleAndBias(const std::array<float, 3>& scale, const std::array<float, 3>& bias)
+{
+    // NaN never compares equal, so the first call always sends the values
+    if (scale != currentScale && uniforms.scale >= 0) {
+        glUniform3f(uniforms.scale, scale[0], scale[1], scale[2]);
+    }
+    if (bias != currentBias && uniforms.bias >= 0) {
+        glUniform3f(uniforms.bias, bias[0], bias[1], bias[2]);
+    }
+    currentScale = scale;
+    currentBias = bias;
+    GLDEBUG();
+}
+
+void Shader::setLayered(bool layered)
+{
+    if (currentLayered != layered) {
+        glUniform1i(uniforms.layered, layered);
+        currentLayered = layered;
+        GLDEBUG();
+    }
+}
+
@@ -1,9 +1,22 @@
 #pragma once
 
 #include <string>
+#include <array>
 
 #define SHADER_CODE_SIZE (1<<14)
 
+// locations of the uniforms set by vpv, resolved once the program is linked (-1 when unused)
+struct ShaderUniforms {
+    int tex;
+    int transform;
+    int scale;
+    int bias;
+    int time;
+    int layered;
+    int layers[3];
+    int components;
+};
+
 struct Shader {
     std::string ID;
     std::string name;
@@ -15,11 +28,28 @@ struct Shader {
     ~Shader();
 
     bool compile();
+    // compiles the shader on first use, does nothing if the shader is already bound
     void bind();
+    // the renderer restores the program of the application after drawing,
+    // so the next bind() cannot be skipped
+    static void forgetBinding();
+    static Shader* getBound();
 
     void setParameter(const std::string& name, float a, float b, float c);
+    // the values are only sent if they changed since the last call
+    void setScaleAndBias(const std::array<float, 3>& scale, const std::array<float, 3>& bias);
+    void setLayered(bool layered);
 
     unsigned int program;
+    ShaderUniforms uniforms;
 private:
+    // values of the uniforms in the program, to skip redundant changes
+    std::array<float, 3> currentScale;
+    std::array<float, 3> currentBias;
+    int currentLayered;
+    // the compilation failed, it is not attempted again
+    bool failed;
+
+    void resolveUniforms();
 };
 
@@ -1,11 +1,18 @@
 #include <list>
+#include <map>
+#include <tuple>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include <cstring>
 
 #include <GL/gl3w.h>
 
 #include "Texture.hpp"
 #include "Image.hpp"
 #include "globals.hpp"
+#include "events.hpp"
 
 const char* getGLError(GLenum error)
 {
@@ -33,33 +40,83 @@ const char* getGLError(GLenum error)
     } \
 }
 
-#define TEXTURE_MAX_SIZE 1024
+// the tiles that are not used anymore are kept to be reused by textures of the same geometry,
+// they are indexed by their width, height and internal format
+typedef std::tuple<size_t, size_t, GLuint> TileFormat;
 
-static std::list<TextureTile> tileCache;
+struct PooledTile {
+    TextureTile tile;
+    // when the tile was given back, idle tiles are deleted
+    uint64_t freedAt;
+    // the tile can be given back by the upload thread and taken by the main thread (or the opposite),
+    // the other context waits for the commands using it to be done before reusing it
+    GLsync fence;
+    std::thread::id owner;
+};
 
-static void initTile(TextureTile t)
+static std::map<TileFormat, std::vector<PooledTile>> tilePool;
+static size_t tilePoolSize = 0;
+// the pool is shared with the upload thread
+static std::mutex tilePoolLock;
+
+// tiles that stay in the pool for this long are deleted, in milliseconds
+#define TILE_POOL_IDLE_TIME 10000
+
+// the tiles are uploaded through these pixel buffers in turn, so that filling
+// one of them overlaps with the transfer of the previous ones to the GPU
+#define PIXEL_BUFFER_COUNT 3
+
+struct PixelBuffer {
+    GLuint id = 0;
+    size_t size = 0;
+    // signaled when the GPU is done reading the buffer
+    GLsync fence = 0;
+};
+
+static PixelBuffer pixelBuffers[PIXEL_BUFFER_COUNT];
+static size_t curPixelBuffer = 0;
+
+static double uploadTime;
+// bytes uploaded during the current frame, limited by TEXTURE_UPLOAD_BUDGET
+static size_t uploadedBytes;
+static double averageUploadTime;
+static double averageFrameTime;
+
+// the internal format keeps the precision of the samples, 8 and 16 bits samples are normalized
+static GLuint getInternalFormat(unsigned format, unsigned type)
 {
-    GLuint internalFormat;
-    switch (t.format) {
-        case GL_RED:
-            internalFormat = GL_R32F;
-            break;
-        case GL_RG:
-            internalFormat = GL_RG32F;
-            break;
-        case GL_RGB:
-            internalFormat = GL_RGB32F;
-            break;
-        case GL_RGBA:
-            internalFormat = GL_RGBA32F;
-            break;
+    static const GLuint formats[][4] = {
+        // GL_RED, GL_RG, GL_RGB, GL_RGBA
+        {GL_R8, GL_RG8, GL_RGB8, GL_RGBA8},
+        {GL_R16, GL_RG16, GL_RGB16, GL_RGBA16},
+        {GL_R16F, GL_RG16F, GL_RGB16F, GL_RGBA16F},
+        {GL_R32F, GL_RG32F, GL_RGB32F, GL_RGBA32F},
+    };
+    int t;
+    switch (type) {
+        case GL_UNSIGNED_BYTE: t = 0; break;
+        case GL_UNSIGNED_SHORT: t = 1; break;
+        case GL_HALF_FLOAT: t = 2; break;
+        default: t = 3; break;
+    }
+    switch (format) {
+        case GL_RED: return formats[t][0];
+        case GL_RG: return formats[t][1];
+        case GL_RGB: return formats[t][2];
+        case GL_RGBA: return formats[t][3];
         default:
             assert(0);
+            return 0;
     }
+}
+
+static void initTile(TextureTile t)
+{
+    GLuint internalFormat = getInternalFormat(t.format, t.type);
 
     glBindTexture(GL_TEXTURE_2D, t.id);
     GLDEBUG();
-    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, t.w, t.h, 0, t.format, GL_FLOAT, NULL);
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, t.w, t.h, 0, t.format, t.type, NULL);
     GLDEBUG();
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -88,150 +145,561 @@ static void initTile(TextureTile t)
     GLDEBUG();
 }
 
-static TextureTile takeTile(size_t w, size_t h, unsigned format)
+static size_t getTileMemorySize(const TextureTile& t)
 {
-    for (auto it = tileCache.begin(); it != tileCache.end(); it++) {
-        TextureTile t = *it;
-        if (t.w == w && t.h == h && t.format == format) {
-            tileCache.erase(it);
-            return t;
-        }
+    size_t ss;
+    switch (t.type) {
+        case GL_UNSIGNED_BYTE: ss = 1; break;
+        case GL_UNSIGNED_SHORT: case GL_HALF_FLOAT: ss = 2; break;
+        default: ss = 4; break;
+    }
+    size_t nc;
+    switch (t.format) {
+        case GL_RED: nc = 1; break;
+        case GL_RG: nc = 2; break;
+        case GL_RGB: nc = 3; break;
+        default: nc = 4; break;
     }
+    return t.w * t.h * nc * ss;
+}
 
-    TextureTile tile;
-    if (!tileCache.empty()) {
-        tile = tileCache.back();
-        tileCache.pop_back();
-    } else {
-        glGenTextures(1, &tile.id);
+static TextureTile takeTile(size_t w, size_t h, unsigned format, unsigned type)
+{
+    std::unique_lock<std::mutex> _lock(tilePoolLock);
+    auto it = tilePool.find(TileFormat(w, h, getInternalFormat(format, type)));
+    if (it != tilePool.end() && !it->second.empty()) {
+        // the most recently freed tile
+        PooledTile p = it->second.back();
+        it->second.pop_back();
+        TextureTile t = p.tile;
+        if (p.owner != std::this_thread::get_id()) {
+            glWaitSync(p.fence, 0, GL_TIMEOUT_IGNORED);
+            GLDEBUG();
+        }
+        glDeleteSync(p.fence);
         GLDEBUG();
+        tilePoolSize -= getTileMemorySize(t);
+        t.layer = 0;
+        t.resident = false;
+        t.scale = 1;
+        t.key.clear();
+        return t;
     }
+    _lock.unlock();
+
+    TextureTile tile;
+    glGenTextures(1, &tile.id);
+    GLDEBUG();
     tile.w = w;
     tile.h = h;
     tile.format = format;
+    tile.type = type;
+    tile.layer = 0;
+    tile.resident = false;
+    tile.scale = 1;
+    tile.key.clear();
     initTile(tile);
     return tile;
 }
 
+// delete the pooled tiles that were freed before 'idle' milliseconds ago,
+// and then the oldest ones until the pool fits in TEXTURE_POOL_LIMIT
+static void trimTilePool(double idle)
+{
+    std::lock_guard<std::mutex> _lock(tilePoolLock);
+    size_t limit = gTexturePoolLimitMB*1000000;
+    for (;;) {
+        std::vector<PooledTile>* oldest = nullptr;
+        double age = -1;
+        for (auto& p : tilePool) {
+            // the tiles of a format are sorted by the time they were freed
+            if (p.second.empty())
+                continue;
+            uint64_t t = p.second.front().freedAt;
+            double a = letTimeFlow(&t);
+            if (a > age) {
+                oldest = &p.second;
+                age = a;
+            }
+        }
+        if (!oldest || (age < idle && tilePoolSize <= limit))
+            break;
+
+        TextureTile t = oldest->front().tile;
+        glDeleteSync(oldest->front().fence);
+        oldest->erase(oldest->begin());
+        tilePoolSize -= getTileMemorySize(t);
+        glDeleteTextures(1, &t.id);
+        GLDEBUG();
+    }
+}
+
+// the caller flushes the commands once the tiles are given, so that the fences reach the GPU
 static void giveTile(TextureTile t)
 {
-    tileCache.push_back(t);
+    PooledTile p;
+    p.tile = t;
+    p.freedAt = 0;
+    letTimeFlow(&p.freedAt);
+    p.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    GLDEBUG();
+    p.owner = std::this_thread::get_id();
+    std::lock_guard<std::mutex> _lock(tilePoolLock);
+    tilePool[TileFormat(t.w, t.h, getInternalFormat(t.format, t.type))].push_back(p);
+    tilePoolSize += getTileMemorySize(t);
 }
 
-void Texture::create(size_t w, size_t h, unsigned format)
+void Texture::deleteFence()
+{
+    if (fence) {
+        glDeleteSync((GLsync) fence);
+        fence = nullptr;
+    }
+}
+
+void Texture::clear()
 {
     for (auto t : tiles) {
         giveTile(t);
     }
+    if (!tiles.empty()) {
+        glFlush();
+    }
     tiles.clear();
+    deleteFence();
+    uploadedID.clear();
+    size = ImVec2();
+    channels = 0;
+    layers = 1;
+    type = -1;
+    normalization = 1.f;
+    tiled = false;
+    scale = 1;
+}
+
+static unsigned getGLFormat(size_t nc)
+{
+    switch (nc) {
+        case 1: return GL_RED;
+        case 2: return GL_RG;
+        case 3: return GL_RGB;
+        default: return GL_RGBA;
+    }
+}
+
+static size_t getLayerCount(size_t c)
+{
+    return std::max((size_t) 1, (c + 3) / 4);
+}
 
+// format of the given layer, which holds the channels 4*layer to 4*layer+3
+static unsigned getLayerFormat(size_t c, size_t layer)
+{
+    return getGLFormat(std::min((size_t) 4, c - 4 * layer));
+}
+
+// size of the tiles of the textures, TEXTURE_TILE_SIZE or the largest size supported by the GPU
+static size_t getTileSize()
+{
     static size_t ts = 0;
     if (!ts) {
         GLDEBUG();
-        int _ts;
-        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &_ts);
+        int maxsize;
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxsize);
         GLDEBUG();
-        ts = _ts;
-        ts = TEXTURE_MAX_SIZE;
+        ts = maxsize;
+        if (gTextureTileSize > 0)
+            ts = std::min(ts, (size_t) gTextureTileSize);
     }
+    return ts;
+}
+
+void Texture::create(size_t w, size_t h, size_t c, unsigned type)
+{
+    clear();
+
+    size_t ts = getTileSize();
     for (size_t y = 0; y < h; y += ts) {
         for (size_t x = 0; x < w; x += ts) {
             size_t tw = std::min(ts, w - x);
             size_t th = std::min(ts, h - y);
-            TextureTile t = takeTile(tw, th, format);
-            t.x = x;
-            t.y = y;
-            tiles.push_back(t);
+            for (size_t l = 0; l < getLayerCount(c); l++) {
+                TextureTile t = takeTile(tw, th, getLayerFormat(c, l), type);
+                t.x = x;
+                t.y = y;
+                t.layer = l;
+                tiles.push_back(t);
+            }
         }
     }
 
     this->size.x = w;
     this->size.y = h;
-    this->format = format;
+    this->channels = c;
+    this->layers = getLayerCount(c);
+    this->type = type;
 }
 
-void Texture::upload(const std::shared_ptr<Image>& img, ImRect area, BandIndices bandidx)
+// the samples are uploaded in their native type
+static unsigned getGLType(const Image& img)
 {
+    switch (img.type) {
+        case SAMPLE_U8: return GL_UNSIGNED_BYTE;
+        case SAMPLE_U16: return GL_UNSIGNED_SHORT;
+        case SAMPLE_F16: return GL_HALF_FLOAT;
+        default: return GL_FLOAT;
+    }
+}
+
+static float getNormalization(const Image& img)
+{
+    switch (img.type) {
+        case SAMPLE_U8: return 255.f;
+        case SAMPLE_U16: return 65535.f;
+        default: return 1.f;
+    }
+}
+
+// copy the channels [c0,c0+nc) of the part 'area' of the image to 'dst' whose rows are 'dstwidth' pixels long
+static void copyArea(uint8_t* dst, size_t dstwidth, const Image& img, ImRect area, size_t c0, size_t nc)
+{
+    size_t ss = getSampleSize(img.type);
+    size_t sx = area.Min.x;
+    size_t sy = area.Min.y;
+    size_t aw = area.GetWidth();
+    size_t ah = area.GetHeight();
+    const uint8_t* src = (const uint8_t*) img.samples;
+
+    if (c0 == 0 && nc == img.c) {
+        size_t pixelsize = img.c * ss;
+        for (size_t y = 0; y < ah; y++) {
+            memcpy(dst + y * dstwidth * pixelsize, src + ((sy+y)*img.w+sx) * pixelsize, aw * pixelsize);
+        }
+        return;
+    }
+
+    for (size_t y = 0; y < ah; y++) {
+        uint8_t* out = dst + y*dstwidth*nc*ss;
+        const uint8_t* in = src + (((sy+y)*img.w+sx)*img.c+c0)*ss;
+        for (size_t x = 0; x < aw; x++) {
+            memcpy(out + x*nc*ss, in + x*img.c*ss, nc*ss);
+        }
+    }
+}
+
+// map the next pixel buffer of the ring, waiting for the GPU to be done with it if needed
+// the buffer stays bound to GL_PIXEL_UNPACK_BUFFER
+static uint8_t* mapPixelBuffer(PixelBuffer*& pbo, size_t size)
+{
+    pbo = &pixelBuffers[curPixelBuffer];
+    curPixelBuffer = (curPixelBuffer + 1) % PIXEL_BUFFER_COUNT;
+
+    if (!pbo->id) {
+        glGenBuffers(1, &pbo->id);
+        GLDEBUG();
+    }
+    if (pbo->fence) {
+        glClientWaitSync(pbo->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        glDeleteSync(pbo->fence);
+        pbo->fence = 0;
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo->id);
+    GLDEBUG();
+    if (pbo->size < size) {
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+        GLDEBUG();
+        pbo->size = size;
+    }
+    void* data = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                                  GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    GLDEBUG();
+    if (!data) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        GLDEBUG();
+    }
+    return (uint8_t*) data;
+}
+
+// upload the part 'intersect' of the image into the texture tile, only the channels of its layer
+// 'async' uses the ring of pixel buffers, which belongs to the main thread
+static void uploadToTile(const TextureTile& t, const Image& img, ImRect intersect, bool async)
+{
+    size_t c0 = 4 * t.layer;
+    size_t nc = std::min((size_t) 4, img.c - c0);
+    size_t w = img.w;
+    size_t ss = getSampleSize(img.type);
+
+    ImRect totile = intersect;
+    totile.Translate(ImVec2(-t.x, -t.y));
+
+    const uint8_t* data = nullptr;
+    PixelBuffer* pbo = nullptr;
+    if (async) {
+        // the samples are copied to a pixel buffer from which the GPU reads them asynchronously
+        size_t size = intersect.GetWidth() * intersect.GetHeight() * nc * ss;
+        uint8_t* buffer = mapPixelBuffer(pbo, size);
+        if (buffer) {
+            copyArea(buffer, intersect.GetWidth(), img, intersect, c0, nc);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            GLDEBUG();
+            // offset in the bound pixel buffer
+            data = (const uint8_t*) 0;
+        } else {
+            pbo = nullptr;
+        }
+    }
+    if (!pbo) {
+        if (nc == img.c) {
+            data = (const uint8_t*) img.samples + (w * (size_t)intersect.Min.y + (size_t)intersect.Min.x)*img.c*ss;
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, w);
+        } else {
+            // the channels of the layer are interleaved with the others
+            static thread_local std::vector<uint8_t> layerbuffer;
+            layerbuffer.resize(intersect.GetWidth() * intersect.GetHeight() * nc * ss);
+            copyArea(layerbuffer.data(), intersect.GetWidth(), img, intersect, c0, nc);
+            data = layerbuffer.data();
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, intersect.GetWidth());
+        }
+    }
+    // rows of 8 and 16 bits samples are not necessarily aligned on 4 bytes
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    glBindTexture(GL_TEXTURE_2D, t.id);
+    GLDEBUG();
+
     GLDEBUG();
-    bool needsreshape = bandidx[0] != 0 || bandidx[1] != 1 || bandidx[2] != 2 || img->c > 3;
-    unsigned int glformat = GL_RGB;
-    if (!needsreshape) {
-        if (img->c == 1)
-            glformat = GL_RED;
-        else if (img->c == 2)
-            glformat = GL_RG;
-        else if (img->c == 3)
-            glformat = GL_RGB;
+    glTexSubImage2D(GL_TEXTURE_2D, 0, totile.Min.x, totile.Min.y,
+                    totile.GetWidth(), totile.GetHeight(), t.format, t.type, data);
+    GLDEBUG();
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    GLDEBUG();
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    GLDEBUG();
+
+    if (pbo) {
+        pbo->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        GLDEBUG();
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        GLDEBUG();
     }
 
+    if (gDownsamplingQuality >= 2) {
+        glGenerateMipmap(GL_TEXTURE_2D);
+        GLDEBUG();
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    GLDEBUG();
+}
+
+// create the tiles to upload img to if needed
+void Texture::prepare(const std::shared_ptr<Image>& img, size_t scale)
+{
+    unsigned int gltype = getGLType(*img);
+
     size_t w = img->w;
     size_t h = img->h;
 
-    if (size.x != w || size.y != h || format != glformat) {
-        create(w, h, glformat);
+    if (tiled || size.x != w || size.y != h || channels != img->c || type != gltype || this->scale != scale) {
+        create(w, h, img->c, gltype);
+        normalization = getNormalization(*img);
+        for (auto& t : tiles) {
+            t.scale = scale;
+        }
+        this->scale = scale;
+    } else if (img->ID != uploadedID) {
+        for (auto& t : tiles) {
+            t.resident = false;
+        }
     }
+    uploadedID = img->ID;
+}
 
-    for (auto t : tiles) {
+void Texture::setFence()
+{
+    if (!gUsePBO)
+        return;
+    deleteFence();
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    GLDEBUG();
+}
+
+void Texture::upload(const std::shared_ptr<Image>& img, ImRect area, size_t scale)
+{
+    GLDEBUG();
+    uint64_t time = 0;
+    letTimeFlow(&time);
+
+    prepare(img, scale);
+    for (const auto& t : tiles) {
         ImRect intersect(t.x, t.y, t.x+t.w, t.y+t.h);
         intersect.ClipWithFull(area);
-        ImRect totile = intersect;
-        totile.Translate(ImVec2(-t.x, -t.y));
 
         if (intersect.GetWidth() == 0 || intersect.GetHeight() == 0) {
             continue;
         }
 
-        const float* data;
-        if (!needsreshape) {
-            data = img->pixels + (w * (size_t)intersect.Min.y + (size_t)intersect.Min.x)*img->c;
-            glPixelStorei(GL_UNPACK_ROW_LENGTH, w);
-        } else {
-            // NOTE: all this copy and upload is slow
-            // 1) use opengl buffer to avoid pausing at each tile's upload
-            // 2° prepare the reshapebuffers in a thread
-            // storing these images as planar would help with cache
-            static float* reshapebuffer = new float[TEXTURE_MAX_SIZE*TEXTURE_MAX_SIZE*3];
-            for (int c = 0; c < 3; c++) {
-                size_t b = bandidx[c];
-                if (b >= img->c) {
-                    for (int y = 0; y < t.h; y++) {
-                        for (int x = 0; x < t.w; x++) {
-                            reshapebuffer[(y*TEXTURE_MAX_SIZE+x)*3+c] = 0;
-                        }
-                    }
-                    continue;
-                }
-                int sx = intersect.Min.x;
-                int sy = intersect.Min.y;
-                for (int y = 0; y < intersect.GetHeight(); y++) {
-                    for (int x = 0; x < intersect.GetWidth(); x++) {
-                        float v = img->pixels[((sy+y)*img->w+sx+x)*img->c+b];
-                        reshapebuffer[(y*TEXTURE_MAX_SIZE+x)*3+c] = v;
-                    }
-                }
-            }
-            data = reshapebuffer;
-            glPixelStorei(GL_UNPACK_ROW_LENGTH, TEXTURE_MAX_SIZE);
+        uploadToTile(t, *img, intersect, gUsePBO);
+        uploadedBytes += intersect.GetWidth() * intersect.GetHeight() * getTileMemorySize(t) / (t.w * t.h);
+    }
+    setFence();
+
+    uploadTime += letTimeFlow(&time);
+}
+
+bool Texture::makeResident(const std::shared_ptr<Image>& img, ImRect area, size_t scale)
+{
+    GLDEBUG();
+    uint64_t time = 0;
+    letTimeFlow(&time);
+
+    letTimeFlow(&lastUsed);
+
+    prepare(img, scale);
+    std::vector<TextureTile*> missing;
+    for (auto& t : tiles) {
+        ImRect r(t.x, t.y, t.x+t.w, t.y+t.h);
+        if (!t.resident && r.Overlaps(area)) {
+            missing.push_back(&t);
         }
+    }
+    // the tiles closest to the center of the area are uploaded first
+    // (the sort is stable so that the layers of a tile stay together)
+    ImVec2 center = area.GetCenter();
+    std::stable_sort(missing.begin(), missing.end(), [&](const TextureTile* a, const TextureTile* b) {
+        ImVec2 da = ImVec2(a->x + a->w / 2.f, a->y + a->h / 2.f) - center;
+        ImVec2 db = ImVec2(b->x + b->w / 2.f, b->y + b->h / 2.f) - center;
+        return da.x*da.x + da.y*da.y < db.x*db.x + db.y*db.y;
+    });
 
-        glBindTexture(GL_TEXTURE_2D, t.id);
-        GLDEBUG();
+    size_t uploaded = 0;
+    for (auto t : missing) {
+        if (!texture_can_upload())
+            break;
+        // the whole tile is uploaded, so that it is not uploaded again when the area moves
+        uploadToTile(*t, *img, ImRect(t->x, t->y, t->x+t->w, t->y+t->h), gUsePBO);
+        uploadedBytes += getTileMemorySize(*t);
+        t->resident = true;
+        uploaded++;
+    }
+    if (uploaded) {
+        setFence();
+    }
 
-        GLDEBUG();
-        glTexSubImage2D(GL_TEXTURE_2D, 0, totile.Min.x, totile.Min.y,
-                        totile.GetWidth(), totile.GetHeight(), glformat, GL_FLOAT, data);
-        GLDEBUG();
-        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-        GLDEBUG();
+    uploadTime += letTimeFlow(&time);
+    return uploaded == missing.size();
+}
 
-        if (gDownsamplingQuality >= 2) {
-            glGenerateMipmap(GL_TEXTURE_2D);
-            GLDEBUG();
+void Texture::uploadAll(const std::shared_ptr<Image>& img)
+{
+    prepare(img, 1);
+    for (auto& t : tiles) {
+        uploadToTile(t, *img, ImRect(t.x, t.y, t.x+t.w, t.y+t.h), false);
+        t.resident = true;
+    }
+    // the fence is waited on by the main thread, so it has to reach the GPU
+    deleteFence();
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    GLDEBUG();
+    glFlush();
+    GLDEBUG();
+}
+
+bool Texture::isReady()
+{
+    if (!fence)
+        return true;
+    GLenum status = glClientWaitSync((GLsync) fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    if (status == GL_TIMEOUT_EXPIRED)
+        return false;
+    deleteFence();
+    return true;
+}
+
+size_t Texture::getMemorySize() const
+{
+    size_t size = 0;
+    for (const auto& t : tiles) {
+        size += getTileMemorySize(t);
+    }
+    return size;
+}
+
+void Texture::uploadTile(const std::string& key, const std::shared_ptr<Image>& tile,
+                         int x, int y, size_t scale)
+{
+    GLDEBUG();
+    uint64_t time = 0;
+    letTimeFlow(&time);
+
+    if (!tiled) {
+        clear();
+        tiled = true;
+    }
+
+    unsigned int gltype = getGLType(*tile);
+    for (size_t l = 0; l < getLayerCount(tile->c); l++) {
+        TextureTile t = takeTile(tile->w, tile->h, getLayerFormat(tile->c, l), gltype);
+        t.x = 0;
+        t.y = 0;
+        t.layer = l;
+        uploadToTile(t, *tile, ImRect(0, 0, tile->w, tile->h), gUsePBO);
+        uploadedBytes += getTileMemorySize(t);
+        t.resident = true;
+
+        t.x = x;
+        t.y = y;
+        t.scale = scale;
+        t.key = key;
+        tiles.push_back(t);
+    }
+    // coarse tiles are drawn first, so that finer tiles cover them
+    // (the layers of a tile stay together since they have the same scale)
+    std::stable_sort(tiles.begin(), tiles.end(), [](const TextureTile& a, const TextureTile& b) {
+        return a.scale > b.scale;
+    });
+    channels = tile->c;
+    layers = getLayerCount(tile->c);
+    type = gltype;
+    normalization = getNormalization(*tile);
+
+    uploadTime += letTimeFlow(&time);
+}
+
+void Texture::getLayers(size_t i, BandIndices bands, unsigned ids[3], int components[3]) const
+{
+    for (int b = 0; b < 3; b++) {
+        size_t band = bands[b];
+        if (band >= channels || i + band / 4 >= tiles.size()) {
+            ids[b] = 0;
+            components[b] = -1;
+            continue;
         }
+        ids[b] = tiles[i + band / 4].id;
+        components[b] = band % 4;
+    }
+}
 
-        glBindTexture(GL_TEXTURE_2D, 0);
-        GLDEBUG();
+bool Texture::hasTile(const std::string& key) const
+{
+    for (const auto& t : tiles) {
+        if (t.key == key)
+            return true;
     }
+    return false;
+}
+
+void Texture::retainTiles(std::function<bool(const TextureTile&)> keep)
+{
+    auto it = std::stable_partition(tiles.begin(), tiles.end(), keep);
+    for (auto t = it; t != tiles.end(); t++) {
+        giveTile(*t);
+    }
+    if (it != tiles.end()) {
+        glFlush();
+    }
+    tiles.erase(it, tiles.end());
 }
 
 Texture::~Texture()
@@ -239,6 +707,179 @@ Texture::~Texture()
     for (auto t : tiles) {
         giveTile(t);
     }
+    if (!tiles.empty()) {
+        glFlush();
+    }
     tiles.clear();
+    deleteFence();
+}
+
+struct SharedTexture {
+    std::string id;
+    size_t scale;
+    // once the image is freed, its texture cannot be displayed again
+    std::weak_ptr<Image> image;
+    std::shared_ptr<Texture> texture;
+};
+
+static std::list<SharedTexture> sharedTextures;
+// the upload thread adds the textures it prepares
+static std::mutex sharedTexturesLock;
+
+std::shared_ptr<Texture> texture_acquire(const std::shared_ptr<Image>& image, size_t scale)
+{
+    std::lock_guard<std::mutex> _lock(sharedTexturesLock);
+    for (const auto& s : sharedTextures) {
+        if (s.id == image->ID && s.scale == scale) {
+            // a texture prepared by the upload thread can only be used once its fence is signaled,
+            // the GPU waits for it without blocking this thread
+            if (s.texture->fence) {
+                glWaitSync((GLsync) s.texture->fence, 0, GL_TIMEOUT_IGNORED);
+                GLDEBUG();
+            }
+            return s.texture;
+        }
+    }
+    SharedTexture s;
+    s.id = image->ID;
+    s.scale = scale;
+    s.image = image;
+    s.texture = std::make_shared<Texture>();
+    letTimeFlow(&s.texture->lastUsed);
+    sharedTextures.push_back(s);
+    return s.texture;
+}
+
+// evict the least recently used textures that no window displays until the limit is respected
+// the displayed textures do not count, so that the limit is the memory kept to go back to recent images
+static void evictSharedTextures()
+{
+    std::lock_guard<std::mutex> _lock(sharedTexturesLock);
+    sharedTextures.remove_if([](const SharedTexture& s) {
+        return s.image.expired() && s.texture.use_count() == 1;
+    });
+
+    size_t limit = gTextureCacheLimitMB*1000000;
+    size_t used = 0;
+    for (const auto& s : sharedTextures) {
+        if (s.texture.use_count() == 1)
+            used += s.texture->getMemorySize();
+    }
+    while (used > limit) {
+        auto worst = sharedTextures.end();
+        double last = -1;
+        for (auto it = sharedTextures.begin(); it != sharedTextures.end(); it++) {
+            // the texture is displayed by a window
+            if (it->texture.use_count() > 1)
+                continue;
+            uint64_t t = it->texture->lastUsed;
+            double age = letTimeFlow(&t);
+            if (age > last) {
+                worst = it;
+                last = age;
+            }
+        }
+        if (worst == sharedTextures.end())
+            break;
+        used -= worst->texture->getMemorySize();
+        sharedTextures.erase(worst);
+    }
+}
+
+bool texture_is_shared(const Image& image, size_t scale)
+{
+    std::lock_guard<std::mutex> _lock(sharedTexturesLock);
+    for (const auto& s : sharedTextures) {
+        if (s.id == image.ID && s.scale == scale) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool texture_can_prefetch()
+{
+    std::lock_guard<std::mutex> _lock(sharedTexturesLock);
+    size_t used = 0;
+    for (const auto& s : sharedTextures) {
+        if (s.texture.use_count() == 1)
+            used += s.texture->getMemorySize();
+    }
+    // keep room for the textures that are not displayed anymore
+    return used < gTextureCacheLimitMB*1000000 / 2;
+}
+
+static std::function<void()> makeUploadContextCurrent;
+
+void texture_set_upload_context(std::function<void()> makeCurrent)
+{
+    makeUploadContextCurrent = makeCurrent;
+}
+
+void TextureUpload::progress()
+{
+    static thread_local bool hasContext = false;
+    if (!hasContext) {
+        makeUploadContextCurrent();
+        hasContext = true;
+    }
+
+    std::shared_ptr<Texture> texture = std::make_shared<Texture>();
+    texture->uploadAll(image);
+
+    std::lock_guard<std::mutex> _lock(sharedTexturesLock);
+    bool exists = false;
+    for (const auto& s : sharedTextures) {
+        exists |= s.id == image->ID && s.scale == 1;
+    }
+    // otherwise the main thread started to upload it meanwhile, and this texture is dropped
+    if (!exists) {
+        SharedTexture s;
+        s.id = image->ID;
+        s.scale = 1;
+        s.image = image;
+        s.texture = texture;
+        letTimeFlow(&s.texture->lastUsed);
+        sharedTextures.push_back(s);
+    }
+    loaded = true;
+}
+
+void texture_flush()
+{
+    std::lock_guard<std::mutex> _lock(sharedTexturesLock);
+    sharedTextures.clear();
+    trimTilePool(0);
+}
+
+void texture_end_frame()
+{
+    static uint64_t frameClock = 0;
+    double frameTime = letTimeFlow(&frameClock);
+    averageUploadTime = averageUploadTime * 0.95 + uploadTime * 0.05;
+    // ignore the pauses of the main loop when nothing happens
+    if (frameTime < 250)
+        averageFrameTime = averageFrameTime * 0.95 + frameTime * 0.05;
+    uploadTime = 0;
+    uploadedBytes = 0;
+
+    evictSharedTextures();
+    trimTilePool(TILE_POOL_IDLE_TIME);
+}
+
+bool texture_can_upload()
+{
+    // at least one tile is uploaded per frame, whatever its size
+    return !gTextureUploadBudgetMB || !uploadedBytes || uploadedBytes < gTextureUploadBudgetMB*1000000;
+}
+
+double texture_get_upload_time()
+{
+    return averageUploadTime;
+}
+
+double texture_get_frame_time()
+{
+    return averageFrameTime;
 }
 
@@ -2,31 +2,132 @@
 
 #include <vector>
 #include <memory>
+#include <string>
+#include <functional>
 
 #include "imgui.h"
 #define IMGUI_DEFINE_MATH_OPERATORS
 #include "imgui_internal.h"
 
 #include "Image.hpp"
+#include "Progressable.hpp"
 
 struct TextureTile {
     unsigned id;
     int x, y;
     size_t w, h;
     unsigned format;
+    // type of the uploaded samples (GL_UNSIGNED_BYTE, GL_FLOAT...)
+    unsigned type;
+    // the channels 4*layer to 4*layer+3 of the image, the layers of a tile follow each other
+    size_t layer;
+    // whether the whole tile holds the current image (see makeResident)
+    bool resident;
+    // a texture pixel covers scale*scale image pixels, (x,y) are expressed in texture pixels
+    size_t scale;
+    std::string key;
 };
 
 struct Texture {
     std::vector<TextureTile> tiles;
+    // signaled when the GPU has received the last uploads made through pixel buffers (see isReady)
+    void* fence = nullptr;
+    std::string uploadedID;
     ImVec2 size;
-    unsigned format = -1;
+    // number of channels of the image, uploaded in layers of 4 channels
+    size_t channels = 0;
+    size_t layers = 1;
+    unsigned type = -1;
+    // OpenGL normalizes integer samples to [0,1], the sampled values have to be multiplied by this
+    float normalization = 1.f;
+    bool tiled = false;
+    size_t scale = 1;
+    // last time the texture was drawn, the least recently used shared textures are evicted first
+    uint64_t lastUsed = 0;
 
     ~Texture();
 
-    void upload(const std::shared_ptr<Image>& img, ImRect area, BandIndices bandidx={0,1,2});
+    // all the channels are uploaded, the bands to display are selected by the shader (see getLayers)
+    // 'scale' is the reduction factor of img when it is a level of a pyramid
+    // upload the pixels of 'area', eg. because they changed
+    void upload(const std::shared_ptr<Image>& img, ImRect area, size_t scale=1);
+    // upload the tiles overlapping 'area' that do not hold the image yet, the others are left as is
+    // the tiles closest to the center of the area go first, within the upload budget of the frame
+    // returns whether all these tiles are resident, otherwise it should be called again next frame
+    bool makeResident(const std::shared_ptr<Image>& img, ImRect area, size_t scale=1);
+    // upload the whole image synchronously, from the upload thread (see TextureUpload)
+    void uploadAll(const std::shared_ptr<Image>& img);
     ImVec2 getSize() { return size; }
 
+    // tiles of tiled images are uploaded individually, (x,y) being their position in the reduced image
+    void uploadTile(const std::string& key, const std::shared_ptr<Image>& tile,
+                    int x, int y, size_t scale);
+    bool hasTile(const std::string& key) const;
+    void retainTiles(std::function<bool(const TextureTile&)> keep);
+    void clear();
+
+    // whether the GPU has received all the uploads, until then the texture should not be drawn
+    bool isReady();
+
+    // video memory used by the tiles, in bytes
+    size_t getMemorySize() const;
+
+    // texture ids and components holding the bands of the i-th tile (a layer 0 tile),
+    // the id is 0 and the component -1 for bands that the image does not have
+    void getLayers(size_t i, BandIndices bands, unsigned ids[3], int components[3]) const;
+
 private:
-    void create(size_t w, size_t h, unsigned format);
+    void create(size_t w, size_t h, size_t c, unsigned type);
+    void prepare(const std::shared_ptr<Image>& img, size_t scale);
+    void setFence();
+    void deleteFence();
+};
+
+// the textures of non-tiled images are shared by the windows displaying them, so that an image
+// shown in several windows is uploaded once; 'scale' is the level of the pyramid of the image
+// textures that are not displayed anymore are kept up to TEXTURE_CACHE_LIMIT, the least recently used
+// being evicted first, so that going back to a recent image (eg. flicking between two frames) only
+// binds its texture again
+std::shared_ptr<Texture> texture_acquire(const std::shared_ptr<Image>& image, size_t scale);
+// release all the shared textures, before the OpenGL context is destroyed
+void texture_flush();
+bool texture_is_shared(const Image& image, size_t scale);
+
+// prepares the shared texture of an image that will be displayed soon (typically the next frames of
+// a video), from the upload thread which owns an OpenGL context sharing its objects with the main one
+// the main thread waits for the fence of the texture before drawing it
+class TextureUpload : public Progressable {
+    std::shared_ptr<Image> image;
+    bool loaded;
+
+public:
+    TextureUpload(const std::shared_ptr<Image>& image) : image(image), loaded(false) {
+    }
+
+    float getProgressPercentage() const {
+        return loaded ? 1.f : 0.f;
+    }
+
+    bool isLoaded() const {
+        return loaded;
+    }
+
+    void progress();
 };
 
+// called once by the upload thread before its first upload
+void texture_set_upload_context(std::function<void()> makeCurrent);
+// whether the textures prepared in advance still leave room in TEXTURE_CACHE_LIMIT
+bool texture_can_prefetch();
+
+// time spent uploading textures per frame and duration of the frames, in milliseconds
+// both are averaged over the last frames, to compare the upload methods (see USE_PBO)
+// also evicts the shared textures over the limit and the idle tiles of the pool (see TEXTURE_POOL_LIMIT)
+void texture_end_frame();
+double texture_get_upload_time();
+double texture_get_frame_time();
+
+// whether the uploads of the current frame are still within TEXTURE_UPLOAD_BUDGET,
+// so that a huge image is streamed over several frames instead of freezing the interface
+bool texture_can_upload();
+
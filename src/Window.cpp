@@ -472,6 +472,9 @@ void Window::displaySequence(Sequence& seq)
     if (seq.colormap && seq.view && seq.player) {
         if (gShowImage && seq.colormap->shader) {
             ImGui::PushClipRect(clip.Min, clip.Max, true);
+            if (!seq.getCurrentImage() && seq.preview.image) {
+                displayarea.requestPreview(seq.preview);
+            }
             displayarea.draw(seq.getCurrentImage(), clip.Min, winSize, seq.colormap, seq.view, factor);
             ImGui::PopClipRect();
         }
@@ -802,7 +805,13 @@ void Window::displaySequence(Sequence& seq)
 
         if (isKeyPressed("a")) {
             resetSat = true;
-            if (isKeyDown("shift")) {
+            if (isKeyDown("shift") && isKeyDown("control")) {
+                seq.colormap->autoContrast = !seq.colormap->autoContrast;
+                seq.colormap->autoContrastValid = false;
+                if (seq.colormap->autoContrast && seq.image) {
+                    seq.colormap->followImage(seq.image);
+                }
+            } else if (isKeyDown("shift")) {
                 seq.snapScaleAndBias();
             } else {
                 ImVec2 p1(0, 0);
@@ -0,0 +1,320 @@
+#include <cmath>
+#include <atomic>
+#include <thread>
+#include <sstream>
+#include <algorithm>
+
+#include "Image.hpp"
+#include "builtins.hpp"
+
+typedef std::vector<std::shared_ptr<Image>> Images;
+typedef std::vector<float> Params;
+
+// calls fn(x0, y0, x1, y1) on each tile of a w*h output, the threads take the tiles in turn
+template <typename F>
+static void runOnTiles(size_t w, size_t h, F fn)
+{
+    size_t tw = (w + BUILTIN_TILE_SIZE - 1) / BUILTIN_TILE_SIZE;
+    size_t th = (h + BUILTIN_TILE_SIZE - 1) / BUILTIN_TILE_SIZE;
+    size_t ntiles = tw * th;
+    size_t nthreads = std::max((size_t) 1, std::min((size_t) std::thread::hardware_concurrency(), ntiles));
+    std::atomic<size_t> next(0);
+    auto work = [&]() {
+        for (size_t t = next++; t < ntiles; t = next++) {
+            size_t x0 = (t % tw) * BUILTIN_TILE_SIZE;
+            size_t y0 = (t / tw) * BUILTIN_TILE_SIZE;
+            fn(x0, y0, std::min(w, x0 + BUILTIN_TILE_SIZE), std::min(h, y0 + BUILTIN_TILE_SIZE));
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < nthreads; t++) {
+        threads.emplace_back(work);
+    }
+    work();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+// a - b or |a - b|, an image with a single channel is broadcast to the channels of the other
+template <bool absolute>
+static std::shared_ptr<Image> difference(const Images& images, const Params&, std::string& error)
+{
+    const Image& a = *images[0];
+    const Image& b = *images[1];
+    if (a.w != b.w || a.h != b.h) {
+        error = "the images have different sizes";
+        return nullptr;
+    }
+    if (a.c != b.c && a.c != 1 && b.c != 1) {
+        error = "the images have different numbers of channels";
+        return nullptr;
+    }
+
+    size_t c = std::max(a.c, b.c);
+    std::shared_ptr<Image> out = std::make_shared<Image>(a.w, a.h, c);
+    float* samples = (float*) out->samples;
+    runOnTiles(a.w, a.h, [&](size_t x0, size_t y0, size_t x1, size_t y1) {
+        size_t n = x1 - x0;
+        std::vector<float> rowa(n * a.c), rowb(n * b.c);
+        const float* ra = rowa.data();
+        const float* rb = rowb.data();
+        for (size_t y = y0; y < y1; y++) {
+            a.readSamples((y * a.w + x0) * a.c, n * a.c, rowa.data());
+            b.readSamples((y * b.w + x0) * b.c, n * b.c, rowb.data());
+            float* r = samples + (y * a.w + x0) * c;
+            if (a.c == b.c) {
+                for (size_t i = 0; i < n * c; i++) {
+                    r[i] = ra[i] - rb[i];
+                }
+            } else {
+                for (size_t i = 0; i < n; i++) {
+                    for (size_t d = 0; d < c; d++) {
+                        r[i * c + d] = ra[a.c == 1 ? i : i * c + d] - rb[b.c == 1 ? i : i * c + d];
+                    }
+                }
+            }
+            if (absolute) {
+                for (size_t i = 0; i < n * c; i++) {
+                    r[i] = std::fabs(r[i]);
+                }
+            }
+        }
+    });
+    out->computeRange();
+    return out;
+}
+
+// a * factor + offset
+static std::shared_ptr<Image> scale(const Images& images, const Params& params, std::string&)
+{
+    const Image& a = *images[0];
+    float factor = params[0];
+    float offset = params.size() > 1 ? params[1] : 0.f;
+
+    std::shared_ptr<Image> out = std::make_shared<Image>(a.w, a.h, a.c);
+    float* samples = (float*) out->samples;
+    runOnTiles(a.w, a.h, [&](size_t x0, size_t y0, size_t x1, size_t y1) {
+        size_t n = (x1 - x0) * a.c;
+        for (size_t y = y0; y < y1; y++) {
+            float* r = samples + (y * a.w + x0) * a.c;
+            a.readSamples((y * a.w + x0) * a.c, n, r);
+            for (size_t i = 0; i < n; i++) {
+                r[i] = r[i] * factor + offset;
+            }
+        }
+    });
+    out->computeRange();
+    return out;
+}
+
+// the channels of a in the given order, for example '@channel 1 2 1 0' swaps red and blue
+static std::shared_ptr<Image> channel(const Images& images, const Params& params, std::string& error)
+{
+    const Image& a = *images[0];
+    std::vector<size_t> channels;
+    for (float p : params) {
+        if (p != (int) p || p < 0 || p >= a.c) {
+            std::ostringstream ss;
+            ss << "invalid channel " << p << ", the image has " << a.c;
+            error = ss.str();
+            return nullptr;
+        }
+        channels.push_back(p);
+    }
+
+    size_t c = channels.size();
+    std::shared_ptr<Image> out = std::make_shared<Image>(a.w, a.h, c);
+    float* samples = (float*) out->samples;
+    runOnTiles(a.w, a.h, [&](size_t x0, size_t y0, size_t x1, size_t y1) {
+        size_t n = x1 - x0;
+        std::vector<float> row(n * a.c);
+        for (size_t y = y0; y < y1; y++) {
+            a.readSamples((y * a.w + x0) * a.c, n * a.c, row.data());
+            float* r = samples + (y * a.w + x0) * c;
+            for (size_t d = 0; d < c; d++) {
+                const float* in = row.data() + channels[d];
+                for (size_t i = 0; i < n; i++) {
+                    r[i * c + d] = in[i * a.c];
+                }
+            }
+        }
+    });
+    out->computeRange();
+    return out;
+}
+
+// the rectangle of size w*h at (x,y), clipped to the image
+static std::shared_ptr<Image> crop(const Images& images, const Params& params, std::string& error)
+{
+    const Image& a = *images[0];
+    for (float p : params) {
+        if (p < 0) {
+            error = "the crop parameters cannot be negative";
+            return nullptr;
+        }
+    }
+    size_t cx = params[0];
+    size_t cy = params[1];
+    if (cx >= a.w || cy >= a.h) {
+        error = "the crop is outside of the image";
+        return nullptr;
+    }
+    size_t w = std::min((size_t) params[2], a.w - cx);
+    size_t h = std::min((size_t) params[3], a.h - cy);
+    if (!w || !h) {
+        error = "the crop is empty";
+        return nullptr;
+    }
+
+    std::shared_ptr<Image> out = std::make_shared<Image>(w, h, a.c);
+    float* samples = (float*) out->samples;
+    runOnTiles(w, h, [&](size_t x0, size_t y0, size_t x1, size_t y1) {
+        for (size_t y = y0; y < y1; y++) {
+            a.readSamples(((cy + y) * a.w + cx + x0) * a.c, (x1 - x0) * a.c,
+                          samples + (y * w + x0) * a.c);
+        }
+    });
+    out->computeRange();
+    return out;
+}
+
+// mean of the blocks of 2x2 pixels, the last row and column are repeated for odd sizes
+static std::shared_ptr<Image> down2(const Images& images, const Params&, std::string&)
+{
+    const Image& a = *images[0];
+    size_t w = (a.w + 1) / 2;
+    size_t h = (a.h + 1) / 2;
+    size_t c = a.c;
+
+    std::shared_ptr<Image> out = std::make_shared<Image>(w, h, c);
+    float* samples = (float*) out->samples;
+    runOnTiles(w, h, [&](size_t x0, size_t y0, size_t x1, size_t y1) {
+        size_t n = x1 - x0;
+        size_t m = std::min(a.w - 2 * x0, 2 * n);
+        // padded to an even number of pixels
+        std::vector<float> row0(2 * n * c), row1(2 * n * c);
+        for (size_t y = y0; y < y1; y++) {
+            a.readSamples((2 * y * a.w + 2 * x0) * c, m * c, row0.data());
+            a.readSamples((std::min(2 * y + 1, a.h - 1) * a.w + 2 * x0) * c, m * c, row1.data());
+            if (m < 2 * n) {
+                std::copy_n(&row0[(m - 1) * c], c, &row0[m * c]);
+                std::copy_n(&row1[(m - 1) * c], c, &row1[m * c]);
+            }
+            const float* r0 = row0.data();
+            const float* r1 = row1.data();
+            float* r = samples + (y * w + x0) * c;
+            for (size_t i = 0; i < n; i++) {
+                for (size_t d = 0; d < c; d++) {
+                    size_t k = 2 * i * c + d;
+                    r[i * c + d] = (r0[k] + r0[k + c] + r1[k] + r1[k + c]) * 0.25f;
+                }
+            }
+        }
+    });
+    out->computeRange();
+    return out;
+}
+
+// norm of the centered differences of each channel, the borders are repeated
+static std::shared_ptr<Image> gradient(const Images& images, const Params&, std::string&)
+{
+    const Image& a = *images[0];
+    size_t c = a.c;
+
+    std::shared_ptr<Image> out = std::make_shared<Image>(a.w, a.h, c);
+    float* samples = (float*) out->samples;
+    runOnTiles(a.w, a.h, [&](size_t x0, size_t y0, size_t x1, size_t y1) {
+        size_t n = x1 - x0;
+        // the rows of the tile with one pixel on each side
+        auto readPadded = [&](size_t y, std::vector<float>& row) {
+            size_t xa = x0 ? x0 - 1 : 0;
+            size_t xb = std::min(a.w, x1 + 1);
+            float* dst = &row[(xa + 1 - x0) * c];
+            a.readSamples((y * a.w + xa) * c, (xb - xa) * c, dst);
+            if (!x0)
+                std::copy_n(&row[c], c, &row[0]);
+            if (x1 == a.w)
+                std::copy_n(&row[n * c], c, &row[(n + 1) * c]);
+        };
+        std::vector<float> up((n + 2) * c), cur((n + 2) * c), down((n + 2) * c);
+        for (size_t y = y0; y < y1; y++) {
+            readPadded(y ? y - 1 : 0, up);
+            readPadded(y, cur);
+            readPadded(std::min(y + 1, a.h - 1), down);
+            const float* u = up.data() + c;
+            const float* l = cur.data();
+            const float* rr = cur.data() + 2 * c;
+            const float* dn = down.data() + c;
+            float* r = samples + (y * a.w + x0) * c;
+            for (size_t k = 0; k < n * c; k++) {
+                float gx = (rr[k] - l[k]) * 0.5f;
+                float gy = (dn[k] - u[k]) * 0.5f;
+                r[k] = std::sqrt(gx * gx + gy * gy);
+            }
+        }
+    });
+    out->computeRange();
+    return out;
+}
+
+struct Builtin {
+    const char* name;
+    int arity;
+    // -1 for any number of parameters
+    int minParams, maxParams;
+    const char* usage;
+    std::shared_ptr<Image> (*edit)(const Images& images, const Params& params, std::string& error);
+};
+
+static const Builtin builtins[] = {
+    {"diff", 2, 0, 0, "@diff a b", difference<false>},
+    {"absdiff", 2, 0, 0, "@absdiff a b", difference<true>},
+    {"scale", 1, 1, 2, "@scale a factor [offset]", scale},
+    {"channel", 1, 1, -1, "@channel a c1 [c2...]", channel},
+    {"crop", 1, 4, 4, "@crop a x y w h", crop},
+    {"down2", 1, 0, 0, "@down2 a", down2},
+    {"gradient", 1, 0, 0, "@gradient a", gradient},
+};
+
+static const Builtin* get_builtin(const std::string& name)
+{
+    for (const Builtin& b : builtins) {
+        if (name == b.name)
+            return &b;
+    }
+    return nullptr;
+}
+
+int builtin_get_arity(const std::string& name)
+{
+    const Builtin* b = get_builtin(name);
+    return b ? b->arity : 0;
+}
+
+std::shared_ptr<Image> edit_images_builtin(const std::string& prog,
+                                           const std::vector<std::shared_ptr<Image>>& images,
+                                           std::string& error)
+{
+    std::istringstream ss(prog);
+    std::string name;
+    ss >> name;
+    const Builtin* b = get_builtin(name);
+    if (!b) {
+        error = "unknown builtin edit '@" + name + "'";
+        return nullptr;
+    }
+
+    Params params;
+    float p;
+    while (ss >> p) {
+        params.push_back(p);
+    }
+    if (!ss.eof() || (int) params.size() < b->minParams
+        || (b->maxParams >= 0 && (int) params.size() > b->maxParams)
+        || (int) images.size() != b->arity) {
+        error = std::string("usage: ") + b->usage;
+        return nullptr;
+    }
+    return b->edit(images, params, error);
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <memory>
+
+struct Image;
+
+// the builtin edits are processed by tiles of BUILTIN_TILE_SIZE*BUILTIN_TILE_SIZE pixels spread over threads
+#define BUILTIN_TILE_SIZE 256
+
+// number of images taken by the builtin edit 'name', 0 if there is no such edit
+int builtin_get_arity(const std::string& name);
+
+// 'prog' is the name of the edit followed by its parameters, for example "scale 0.5 10"
+std::shared_ptr<Image> edit_images_builtin(const std::string& prog,
+                                           const std::vector<std::shared_ptr<Image>>& images,
+                                           std::string& error);
@@ -12,6 +12,7 @@
 #include "Window.hpp"
 #include "Sequence.hpp"
 #include "ImageCollection.hpp"
+#include "Reduction.hpp"
 #include "Player.hpp"
 #include "Image.hpp"
 #include "View.hpp"
@@ -321,6 +322,28 @@ void config::load()
     (*state)["ImageCollection"].setClass(kaguya::UserdataMetatable<ImageCollection>()
                              .addFunction("get_filename", &ImageCollection::getFilename)
                              .addFunction("get_length", &ImageCollection::getLength)
+                             .addFunction("get_reduction", &ImageCollection::getReduction)
+                            );
+
+    (*state)["Reduction"].setClass(kaguya::UserdataMetatable<Reduction>()
+                             .addFunction("is_loaded", &Reduction::isLoaded)
+                             .addFunction("get_progress", &Reduction::getProgressPercentage)
+                             .addFunction("get_error", &Reduction::getError)
+                             .addFunction("get_frames_done", &Reduction::getFramesDone)
+                             .addStaticFunction("get_range", [](Reduction* r){
+                                                float min, max;
+                                                r->getRange(min, max);
+                                                return std::tuple<float,float>(min, max);
+                                                })
+                             .addStaticFunction("get_histogram", [](Reduction* r){
+                                                float min, width;
+                                                auto histogram = r->getHistogram(min, width);
+                                                return std::tuple<std::vector<std::vector<size_t>>,float,float>(histogram, min, width);
+                                                })
+                             .addStaticFunction("get_mean", [](Reduction* r){ return r->getResult(Reduction::MEAN); })
+                             .addStaticFunction("get_variance", [](Reduction* r){ return r->getResult(Reduction::VARIANCE); })
+                             .addStaticFunction("get_min", [](Reduction* r){ return r->getResult(Reduction::MIN); })
+                             .addStaticFunction("get_max", [](Reduction* r){ return r->getResult(Reduction::MAX); })
                             );
 
     (*state)["Sequence"].setClass(kaguya::UserdataMetatable<Sequence>()
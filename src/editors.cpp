@@ -1,4 +1,8 @@
 #include <iostream>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <algorithm>
 
 #include "Image.hpp"
 
@@ -16,6 +20,38 @@
 #endif
 
 #include "editors.hpp"
+#include "builtins.hpp"
+
+// the compiled programs are kept for the next frames of the edited sequences
+#define PLAMBDA_CACHE_SIZE 16
+
+static std::shared_ptr<plambda_program> get_plambda_program(const char* prog, int n, std::string& error)
+{
+    static std::mutex lock;
+    static std::list<std::pair<std::pair<std::string, int>, std::shared_ptr<plambda_program>>> cache;
+
+    std::lock_guard<std::mutex> _lock(lock);
+    auto key = std::make_pair(std::string(prog), n);
+    for (auto it = cache.begin(); it != cache.end(); it++) {
+        if (it->first == key) {
+            cache.splice(cache.begin(), cache, it);
+            return it->second;
+        }
+    }
+
+    char err[PLAMBDA_ERROR_SIZE];
+    plambda_program* p = plambda_compile(n, prog, err);
+    if (!p) {
+        error = err;
+        return nullptr;
+    }
+    std::shared_ptr<plambda_program> program(p, plambda_free);
+    cache.emplace_front(key, program);
+    if (cache.size() > PLAMBDA_CACHE_SIZE) {
+        cache.pop_back();
+    }
+    return program;
+}
 
 static std::shared_ptr<Image> edit_images_plambda(const char* prog,
                               const std::vector<std::shared_ptr<Image>>& images,
@@ -26,23 +62,58 @@ static std::shared_ptr<Image> edit_images_plambda(const char* prog,
     int w[n];
     int h[n];
     int d[n];
+    // plambda works on floats, other sample types are converted for the time of the edit
+    std::vector<std::vector<float>> buffers(n);
     for (size_t i = 0; i < n; i++) {
         std::shared_ptr<Image> img = images[i];
-        x[i] = img->pixels;
+        x[i] = (float*) img->getFloatPixels(buffers[i]);
         w[i] = img->w;
         h[i] = img->h;
         d[i] = img->c;
     }
 
-    int dd;
-    char* err;
-    float* pixels = execute_plambda(n, x, w, h, d, (char*) prog, &dd, &err);
-    if (!pixels) {
-        error = std::string(err);
+    std::shared_ptr<plambda_program> p = get_plambda_program(prog, n, error);
+    if (!p) {
+        return 0;
+    }
+
+    char err[PLAMBDA_ERROR_SIZE];
+    int dd = plambda_eval_dim(p.get(), x, d, err);
+    if (!dd) {
+        error = err;
         return 0;
     }
 
-    std::shared_ptr<Image> img = std::make_shared<Image>(pixels, *w, *h, dd);
+    // most programs are pointwise, the rows are split between threads
+    std::shared_ptr<Image> img = std::make_shared<Image>(*w, *h, dd);
+    float* out = (float*) img->samples;
+    int nthreads = 1;
+    if (plambda_is_parallel(p.get())) {
+        nthreads = std::max(1, std::min((int) std::thread::hardware_concurrency(), *h));
+    }
+    std::vector<std::thread> threads;
+    std::vector<std::string> errors(nthreads);
+    for (int t = 0; t < nthreads; t++) {
+        int y0 = *h * t / nthreads;
+        int y1 = *h * (t + 1) / nthreads;
+        threads.emplace_back([&, t, y0, y1]() {
+            char err[PLAMBDA_ERROR_SIZE];
+            if (!plambda_run_rows(out, dd, p.get(), x, w, h, d, y0, y1, err)) {
+                errors[t] = err;
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (auto& e : errors) {
+        if (!e.empty()) {
+            error = e;
+            return 0;
+        }
+    }
+
+    img->computeRange();
     return img;
 }
 
@@ -58,11 +129,11 @@ static std::shared_ptr<Image> edit_images_gmic(const char* prog,
         std::shared_ptr<Image> img = images[i];
         gmic_image<float>& gimg = gimages[i];
         gimg.assign(img->w, img->h, 1, img->c);
-        const float* xptr = img->pixels;
+        size_t k = 0;
         for (size_t y = 0; y < img->h; y++) {
             for (size_t x = 0; x < img->w; x++) {
                 for (size_t z = 0; z < img->c; z++) {
-                    gimg(x, y, 0, z) = *(xptr++);
+                    gimg(x, y, 0, z) = img->getSample(k++);
                 }
             }
         }
@@ -149,11 +220,11 @@ static std::shared_ptr<Image> edit_images_octave(const char* prog,
             dim_vector size((int)img->h, (int)img->w, (int)img->c);
             NDArray m(size);
 
-            float* xptr = img->pixels;
+            size_t k = 0;
             for (size_t y = 0; y < img->h; y++) {
                 for (size_t x = 0; x < img->w; x++) {
                     for (size_t z = 0; z < img->c; z++) {
-                        m(y, x, z) = *(xptr++);
+                        m(y, x, z) = img->getSample(k++);
                     }
                 }
             }
@@ -220,6 +291,9 @@ std::shared_ptr<Image> edit_images(EditType edittype, const std::string& _prog,
         case OCTAVE:
             image = edit_images_octave(prog, images, error);
             break;
+        case BUILTIN:
+            image = edit_images_builtin(prog, images, error);
+            break;
     }
     return image;
 }
@@ -232,6 +306,29 @@ ImageCollection* create_edited_collection(EditType edittype, const std::string&
 {
     char* prog = (char*) _prog.c_str();
     std::vector<Sequence*> sequences;
+
+    // '@name ids params', the ids of as many sequences as the edit takes images
+    if (edittype == PLAMBDA && *prog == '@') {
+        prog++;
+        std::string name(prog, strcspn(prog, " "));
+        prog += name.size();
+        int arity = std::max(1, builtin_get_arity(name));
+        for (int i = 0; i < arity; i++) {
+            char* old = prog;
+            int a = strtol(prog, &prog, 10) - 1;
+            if (prog == old || a < 0 || a >= gSequences.size()) {
+                return nullptr;
+            }
+            sequences.push_back(gSequences[a]);
+        }
+
+        std::vector<ImageCollection*> collections;
+        for (auto s : sequences) {
+            collections.push_back(s->uneditedCollection);
+        }
+        return new EditedImageCollection(BUILTIN, name + prog, collections);
+    }
+
     while (*prog && *prog != ' ') {
         char* old = prog;
         int a = strtol(prog, &prog, 10) - 1;
@@ -10,6 +10,8 @@ enum EditType {
     PLAMBDA,
     GMIC,
     OCTAVE,
+    // native edits of builtins.hpp, written '@name' in place of a plambda program
+    BUILTIN,
 };
 
 std::shared_ptr<Image> edit_images(EditType edittype, const std::string& prog,
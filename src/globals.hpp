@@ -42,9 +42,22 @@ extern ImVec2 gDefaultSvgOffset;
 extern float gDefaultFramerate;
 extern int gDownsamplingQuality;
 extern size_t gCacheLimitMB;
+extern size_t gTextureCacheLimitMB;
+extern size_t gTexturePoolLimitMB;
+extern int gTextureTileSize;
+extern size_t gTextureUploadBudgetMB;
+extern bool gPrefetchTextures;
+extern bool gShaderCache;
+extern bool gExactQuantiles;
+extern float gAutoContrastQuantile;
+extern float gAutoContrastSmoothing;
+// time from the launch to the first frame, in milliseconds
+extern double gStartupTime;
+extern size_t gTiledLoadingThresholdMB;
 extern bool gPreload;
 extern bool gSmoothHistogram;
 extern bool gForceIioOpen;
+extern bool gUsePBO;
 
 extern int gActive;
 extern int gShowView;
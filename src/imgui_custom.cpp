@@ -26,18 +26,39 @@ void SetShaderCallback(const ImDrawList* parent_list, const ImDrawCmd* pcmd)
 {
     ShaderUserData* userdata = (ShaderUserData*) pcmd->UserCallbackData;
     if (userdata) {
-        userdata->shader->bind();
-        userdata->shader->setParameter("scale", userdata->scale[0], userdata->scale[1], userdata->scale[2]);
-        userdata->shader->setParameter("bias", userdata->bias[0], userdata->bias[1], userdata->bias[2]);
-        uint64_t time;
-        ::letTimeFlow(&time);
-        userdata->shader->setParameter("time", time/1e6, 0, 0);
-        delete userdata;
+        // the program, scale and bias are only sent when they differ from the bound ones
+        Shader* shader = userdata->shader;
+        shader->bind();
+        shader->setLayered(false);
+        shader->setScaleAndBias(userdata->scale, userdata->bias);
+        if (shader->uniforms.time >= 0) {
+            uint64_t time;
+            ::letTimeFlow(&time);
+            glUniform3f(shader->uniforms.time, time/1e6, 0, 0);
+        }
     } else {
         g_shader->bind();
     }
 }
 
+void SetLayersCallback(const ImDrawList* parent_list, const ImDrawCmd* pcmd)
+{
+    LayersUserData* userdata = (LayersUserData*) pcmd->UserCallbackData;
+    Shader* shader = Shader::getBound();
+    // the samplers vpv_layer0-2 use the texture units 1 to 3
+    for (int i = 0; i < 3; i++) {
+        glActiveTexture(GL_TEXTURE1 + i);
+        glBindTexture(GL_TEXTURE_2D, userdata->ids[i]);
+    }
+    glActiveTexture(GL_TEXTURE0);
+    if (shader) {
+        glUniform3i(shader->uniforms.components,
+                    userdata->components[0], userdata->components[1], userdata->components[2]);
+        shader->setLayered(true);
+    }
+    delete userdata;
+}
+
 static ImU32 InvertColorU32(ImU32 in)
 {
     ImVec4 in4 = ColorConvertU32ToFloat4(in);
@@ -5,6 +5,7 @@
 
 namespace ImGui {
 
+    // owned by the caller, kept until the frame is rendered (see DisplayArea)
     struct ShaderUserData {
         Shader* shader;
         std::array<float, 3> scale;
@@ -13,6 +14,14 @@ namespace ImGui {
 
     void SetShaderCallback(const ImDrawList* parent_list, const ImDrawCmd* pcmd);
 
+    // textures and components of the bands to display, when they are not the first three (see Shader.cpp)
+    struct LayersUserData {
+        unsigned ids[3];
+        int components[3];
+    };
+
+    void SetLayersCallback(const ImDrawList* parent_list, const ImDrawCmd* pcmd);
+
     void PlotMultiLines(const char* label,
                         int num_datas,
                         const char** names,
@@ -36,9 +36,13 @@
 #include "ImageProvider.hpp"
 #include "ImageCollection.hpp"
 #include "Histogram.hpp"
+#include "Reduction.hpp"
+#include "Pyramid.hpp"
 #include "Terminal.hpp"
 #include "EditGUI.hpp"
 #include "menu.hpp"
+#include "tiles.hpp"
+#include "Texture.hpp"
 
 #include "cousine_regular.c"
 
@@ -66,9 +70,21 @@ ImVec2 gDefaultSvgOffset;
 float gDefaultFramerate;
 int gDownsamplingQuality;
 size_t gCacheLimitMB;
+size_t gTextureCacheLimitMB;
+size_t gTexturePoolLimitMB;
+int gTextureTileSize;
+bool gPrefetchTextures;
+bool gShaderCache;
+bool gExactQuantiles;
+float gAutoContrastQuantile;
+float gAutoContrastSmoothing;
+double gStartupTime;
+size_t gTextureUploadBudgetMB;
+size_t gTiledLoadingThresholdMB;
 bool gPreload;
 bool gSmoothHistogram;
 bool gForceIioOpen;
+bool gUsePBO;
 static bool showHelp = false;
 int gActive;
 int gShowView;
@@ -315,6 +331,9 @@ int _dowildcard = 0;
 
 int main(int argc, char* argv[])
 {
+    uint64_t startClock = 0;
+    letTimeFlow(&startClock);
+
     bool launched_from_gui = false;
     // on MacOSX, -psn_xxxx is given as argument when launched from GUI
     if (argc >= 2) {
@@ -366,6 +385,18 @@ int main(int argc, char* argv[])
         return -1;
     }
 
+    // the textures of the next frames are uploaded by a thread owning a context that shares the objects of this one
+    SDL_GLContext upload_context = nullptr;
+    gPrefetchTextures = config::get_bool("PREFETCH_TEXTURES");
+    if (gPrefetchTextures) {
+        SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
+        upload_context = SDL_GL_CreateContext(window);
+        SDL_GL_MakeCurrent(window, gl_context);
+        if (!upload_context) {
+            fprintf(stderr, "cannot create the upload context: %s\n", SDL_GetError());
+        }
+    }
+
     SDL_PumpEvents();
     SDL_SetWindowSize(window, w, h);
 
@@ -440,9 +471,19 @@ int main(int argc, char* argv[])
     gDefaultFramerate = config::get_float("DEFAULT_FRAMERATE");
     gDownsamplingQuality = config::get_float("DOWNSAMPLING_QUALITY");
     gCacheLimitMB = (float)config::get_lua()["toMB"](config::get_string("CACHE_LIMIT"));
+    gTextureCacheLimitMB = (float)config::get_lua()["toMB"](config::get_string("TEXTURE_CACHE_LIMIT"));
+    gTexturePoolLimitMB = (float)config::get_lua()["toMB"](config::get_string("TEXTURE_POOL_LIMIT"));
+    gTextureTileSize = config::get_int("TEXTURE_TILE_SIZE");
+    gTextureUploadBudgetMB = (float)config::get_lua()["toMB"](config::get_string("TEXTURE_UPLOAD_BUDGET"));
+    gShaderCache = config::get_bool("SHADER_CACHE");
+    gExactQuantiles = config::get_bool("EXACT_QUANTILES");
+    gAutoContrastQuantile = config::get_float("AUTO_CONTRAST_QUANTILE");
+    gAutoContrastSmoothing = config::get_float("AUTO_CONTRAST_SMOOTHING");
+    gTiledLoadingThresholdMB = (float)config::get_lua()["toMB"](config::get_string("TILED_LOADING_THRESHOLD"));
     gPreload = config::get_bool("PRELOAD");
     gSmoothHistogram = config::get_bool("SMOOTH_HISTOGRAM");
     gForceIioOpen = config::get_bool("FORCE_IIO_OPEN");
+    gUsePBO = config::get_bool("USE_PBO");
 
     parseLayout(config::get_string("DEFAULT_LAYOUT"));
 
@@ -477,6 +518,18 @@ int main(int argc, char* argv[])
             }
         }
 
+        // then the visible tiles of huge images
+        std::shared_ptr<Progressable> tile = tiles_get_next_request();
+        if (tile) {
+            return tile;
+        }
+
+        // the reductions read every frame but do not fill the cache
+        std::shared_ptr<Progressable> reduction = reduction_get_next_request();
+        if (reduction) {
+            return reduction;
+        }
+
         if (!ImageCache::isFull()) {
             // fill the queue with futur frames
             for (int i = 1; i < 100; i++) {
@@ -501,6 +554,13 @@ int main(int argc, char* argv[])
     iothread.start();
 
     LoadingThread computethread([]() -> std::shared_ptr<Progressable> {
+        for (auto seq : gSequences) {
+            if (!seq->image) continue;
+            std::shared_ptr<Progressable> provider = seq->image->pyramid;
+            if (provider && !provider->isLoaded()) {
+                return provider;
+            }
+        }
         if (!gShowHistogram) return nullptr;
         for (auto w : gWindows) {
             std::shared_ptr<Progressable> provider = w->histogram;
@@ -515,10 +575,49 @@ int main(int argc, char* argv[])
                 return provider;
             }
         }
+        // requested once a selection is moved, only the tiles of the current frames are computed
+        for (auto seq : gSequences) {
+            if (!seq->image) continue;
+            std::shared_ptr<Progressable> provider = seq->image->histogramTiles;
+            if (provider && !provider->isLoaded()) {
+                return provider;
+            }
+        }
         return nullptr;
     });
     computethread.start();
 
+    // woken up when a frame enters the cache or when the players move
+    SleepyLoadingThread uploadthread([]() -> std::shared_ptr<Progressable> {
+        if (!texture_can_prefetch()) return nullptr;
+        // upload the textures of the futur frames, so that they are resident when the player reaches them
+        // only the frames already in the cache are considered, without creating their providers
+        for (int i = 1; i < 10; i++) {
+            for (auto seq : gSequences) {
+                if (!seq->player)
+                    continue;
+                ImageCollection* collection = seq->collection;
+                if (!collection || collection->getLength() == 0)
+                    continue;
+                int frame = (seq->player->frame + i - 1) % collection->getLength();
+                std::shared_ptr<Image> image = ImageCache::get(collection->getKey(frame));
+                if (!image || image->isTiled() || texture_is_shared(*image, 1))
+                    continue;
+                return std::make_shared<TextureUpload>(image);
+            }
+        }
+        return nullptr;
+    });
+    if (upload_context) {
+        texture_set_upload_context([window, upload_context]() {
+            SDL_GL_MakeCurrent(window, upload_context);
+        });
+        ImageCache::setStoreCallback([&uploadthread]() {
+            uploadthread.notify();
+        });
+        uploadthread.start();
+    }
+
     if (gSequences.empty()) {
         showHelp = true;
     }
@@ -554,15 +653,35 @@ int main(int argc, char* argv[])
                 iothread.notify();
             }
         }
+        if (tiles_has_requests()) {
+            iothread.notify();
+        }
         if (ImGui::GetFrameCount() % 60 == 0) {
             iothread.notify();
         }
+        if (upload_context) {
+            // the next frames change with the players, and room is made for new textures at the end of frames
+            bool playing = false;
+            for (auto p : gPlayers) {
+                playing |= p->playing;
+            }
+            if (playing || ImGui::GetFrameCount() % 60 == 0) {
+                uploadthread.notify();
+            }
+        }
 
         if (gReloadImages) {
             gReloadImages = false;
             // I don't know yet how to handle editted collection, errors and reload
             // SAD!
             ImageCache::Error::flush();
+            // the changed file is not known here, the reductions of all the sequences start over
+            for (auto seq : gSequences) {
+                if (seq->uneditedCollection)
+                    seq->uneditedCollection->resetReduction();
+                if (seq->collection)
+                    seq->collection->resetReduction();
+            }
             for (auto seq : gSequences) {
                 seq->forgetImage();
             }
@@ -696,6 +815,16 @@ int main(int argc, char* argv[])
         ImGui::Render();
         ImGui_ImplSdlGL3_RenderDrawData(ImGui::GetDrawData());
         SDL_GL_SwapWindow(window);
+        // the startup ends with the first frame showing an image or a preview
+        if (!gStartupTime) {
+            for (auto w : gWindows) {
+                if (w->displayarea.hasDrawn()) {
+                    gStartupTime = letTimeFlow(&startClock);
+                    break;
+                }
+            }
+        }
+        texture_end_frame();
 
         for (auto w : gWindows) {
             w->postRender();
@@ -706,6 +835,12 @@ int main(int argc, char* argv[])
     // do not join the iothread as it can be slow to exit
     computethread.stop();
     computethread.join();
+    if (upload_context) {
+        ImageCache::setStoreCallback(nullptr);
+        uploadthread.stop();
+        uploadthread.notify();
+        uploadthread.join();
+    }
 
 #define CLEAR(tab) \
     for (auto s : tab) \
@@ -719,10 +854,13 @@ int main(int argc, char* argv[])
     CLEAR(gShaders);
     SVG::flushCache();
     ImageCache::flush();
+    texture_flush();
 #undef CLEAR
 
     ImGui_ImplSdlGL3_Shutdown();
     ImGui::DestroyContext();
+    if (upload_context)
+        SDL_GL_DeleteContext(upload_context);
     SDL_GL_DeleteContext(gl_context);
     SDL_DestroyWindow(window);
     SDL_Quit();
@@ -750,6 +888,7 @@ void help()
         T("Each sequence has a colormap, a view and a player.\nThose objects can be shared by multiple sequences.");
         T("A sequence is displayed on a window.");
         ImGui::TextDisabled("sequence definition (glob, :)");
+        T("Command line: use reduce:<n> to show the mean, variance, min and max over the frames of the n-th sequence.");
         T("Shortcuts");
         B(); T("!: remove the current image from the sequence");
     }
@@ -766,6 +905,7 @@ void help()
         B(); T("shift+a: adjust bias/scale by snapping to the nearest 'common' dynamic (eg: 0-1, 0-255, 0-65535)");
         B(); T("ctrl+a: same as 'a' but with the min/max of the current viewed region");
         B(); T("alt+a: same as 'a' but with a saturation cut at 5%% by default");
+        B(); T("ctrl+shift+a: toggle the auto contrast, which fits each new frame during playback");
         B(); T("mouse scroll: adjust the brightness");
         B(); T("shift+mouse scroll: adjust the contrast");
         B(); T("shift+mouse motion: adjust the brightness w.r.t the hovered pixel");
@@ -858,6 +998,7 @@ void help()
             "\nPRELOAD = true"
             "\nCACHE = true"
             "\nCACHE_LIMIT = '2GB'"
+            "\nTILED_LOADING_THRESHOLD = '1GB'"
             "\nSCREENSHOT = 'screenshot_%d.png'"
             "\nWINDOW_WIDTH = 1024"
             "\nWINDOW_HEIGHT = 720"
@@ -871,8 +1012,18 @@ void help()
             "\nDEFAULT_LAYOUT = \"grid\""
             "\nAUTOZOOM = true"
             "\nSATURATIONS = {0.001, 0.01, 0.1}"
+            "\nEXACT_QUANTILES = false"
+            "\nAUTO_CONTRAST_QUANTILE = 0"
+            "\nAUTO_CONTRAST_SMOOTHING = 0.8"
             "\nDEFAULT_FRAMERATE = 30.0"
             "\nDOWNSAMPLING_QUALITY = 1"
+            "\nUSE_PBO = true"
+            "\nTEXTURE_CACHE_LIMIT = '1GB'"
+            "\nTEXTURE_POOL_LIMIT = '256MB'"
+            "\nTEXTURE_TILE_SIZE = 1024"
+            "\nTEXTURE_UPLOAD_BUDGET = '32MB'"
+            "\nPREFETCH_TEXTURES = true"
+            "\nSHADER_CACHE = true"
             "\nSMOOTH_HISTOGRAM = false"
             "\nSVG_OFFSET_X = 0"
             "\nSVG_OFFSET_Y = 0";
@@ -5,8 +5,25 @@
 extern "C" {
 #endif
 
-float* execute_plambda(int n, float** x, int* w, int* h, int* pd,
-                       char* program, int* od, char** error);
+#define PLAMBDA_ERROR_SIZE 1024
+
+struct plambda_program;
+
+// the functions set 'error' (of PLAMBDA_ERROR_SIZE chars) and return 0 on failure
+
+// compiles the program for n input images, the result can be evaluated from several threads
+struct plambda_program* plambda_compile(int n, const char* program, char* error);
+void plambda_free(struct plambda_program* p);
+
+// whether the rows can be evaluated in parallel (no magic variables nor random numbers)
+int plambda_is_parallel(const struct plambda_program* p);
+
+// number of channels of the output
+int plambda_eval_dim(struct plambda_program* p, float** x, int* pd, char* error);
+
+// evaluates the rows [y0,y1) of the output, of the size of the first image
+int plambda_run_rows(float* out, int pdout, struct plambda_program* p,
+                     float** x, int* w, int* h, int* pd, int y0, int y1, char* error);
 
 #ifdef __cplusplus
 }
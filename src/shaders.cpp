@@ -29,8 +29,7 @@ Shader* createShader(const std::string& mainFragment)
     Shader* shader = new Shader;
     std::copy(mainFragment.begin(), mainFragment.end()+1, shader->codeFragment);
     std::copy(defaultVertex.begin(), defaultVertex.end()+1, shader->codeVertex);
-    if (!shader->compile()) {
-    }
+    // compiled on first use (see Shader::bind)
     return shader;
 }
 
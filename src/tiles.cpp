@@ -0,0 +1,79 @@
+#include <string>
+#include <memory>
+#include <map>
+#include <mutex>
+
+#include "imgui.h"
+
+#include "Image.hpp"
+#include "ImageCache.hpp"
+#include "ImageProvider.hpp"
+#include "events.hpp"
+#include "tiles.hpp"
+
+struct TileRequest {
+    std::shared_ptr<ImageProvider> provider;
+    int frame;
+};
+
+static std::map<std::string, TileRequest> requests;
+static std::mutex requestsLock;
+static int lastFrame;
+
+std::string tiles_get_key(const Image& image, size_t tx, size_t ty, size_t scale)
+{
+    return image.ID + ":tile:" + std::to_string(scale) + ":" + std::to_string(tx) + ":" + std::to_string(ty);
+}
+
+std::shared_ptr<Image> tiles_request(const std::shared_ptr<Image>& image, size_t tx, size_t ty, size_t scale)
+{
+    std::string key = tiles_get_key(*image, tx, ty, scale);
+    std::shared_ptr<Image> tile = ImageCache::get(key);
+    if (tile) {
+        letTimeFlow(&tile->lastUsed);
+        return tile;
+    }
+    if (ImageCache::Error::has(key)) {
+        return nullptr;
+    }
+
+    int frame = ImGui::GetFrameCount();
+    std::lock_guard<std::mutex> _lock(requestsLock);
+    lastFrame = frame;
+    auto it = requests.find(key);
+    if (it != requests.end()) {
+        it->second.frame = frame;
+        return nullptr;
+    }
+    auto provider = [image, tx, ty, scale]() {
+        return std::make_shared<TileImageProvider>(image, tx, ty, scale);
+    };
+    requests[key] = TileRequest { std::make_shared<CacheImageProvider>(key, provider), frame };
+    return nullptr;
+}
+
+std::shared_ptr<Image> tiles_get_cached(const Image& image, size_t x, size_t y)
+{
+    return ImageCache::get(tiles_get_key(image, x / TILE_SIZE, y / TILE_SIZE, 1));
+}
+
+std::shared_ptr<ImageProvider> tiles_get_next_request(void)
+{
+    std::lock_guard<std::mutex> _lock(requestsLock);
+    for (auto it = requests.begin(); it != requests.end(); ) {
+        // the tiles that were not requested during the last frame are out of the view
+        if (it->second.provider->isLoaded() || it->second.frame < lastFrame) {
+            it = requests.erase(it);
+        } else {
+            return (it++)->second.provider;
+        }
+    }
+    return nullptr;
+}
+
+bool tiles_has_requests(void)
+{
+    std::lock_guard<std::mutex> _lock(requestsLock);
+    return !requests.empty();
+}
+
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <string>
+#include <memory>
+
+struct Image;
+class ImageProvider;
+
+// tiled images are loaded by pieces of TILE_SIZE*TILE_SIZE pixels
+// a tile at scale s contains one pixel every s pixels, and thus covers TILE_SIZE*s pixels
+#define TILE_SIZE 512
+
+std::string tiles_get_key(const Image& image, size_t tx, size_t ty, size_t scale);
+
+// returns the tile if it is already loaded, otherwise schedules its loading
+std::shared_ptr<Image> tiles_request(const std::shared_ptr<Image>& image, size_t tx, size_t ty, size_t scale);
+
+// returns the full resolution tile containing the pixel (x,y), if it is loaded
+std::shared_ptr<Image> tiles_get_cached(const Image& image, size_t x, size_t y);
+
+// used by the loading thread, forgets about the tiles that are not requested anymore
+std::shared_ptr<ImageProvider> tiles_get_next_request(void);
+
+bool tiles_has_requests(void);
+
@@ -1,15 +1,22 @@
 #include <stdio.h>
 
 #include <setjmp.h>
-#if __STDC_VERSION__ >= 201112L
-_Thread_local
-#endif
-jmp_buf g_jmpbuf;
+
+#include "plambda.h"
+
+// each call into plambda owns its error context, the workers evaluating the rows
+// of the same program in parallel each have their own
+struct plambda_context {
+	jmp_buf jmpbuf;
+	char* error;
+};
 
 #if __STDC_VERSION__ >= 201112L
 _Thread_local
+#elif defined(__GNUC__)
+__thread
 #endif
-char g_error[1024];
+struct plambda_context* g_context;
 
 #define _FAIL_C
 #include <stdarg.h>
@@ -23,22 +30,28 @@ static void fail(const char *fmt, ...)
 	va_end(argp);
 	fprintf(stderr, "\n");
 	fflush(NULL);
-	vsnprintf(g_error, sizeof(g_error), fmt, argp);
-	longjmp(g_jmpbuf, 1);
+	va_start(argp, fmt);
+	vsnprintf(g_context->error, PLAMBDA_ERROR_SIZE, fmt, argp);
+	va_end(argp);
+	longjmp(g_context->jmpbuf, 1);
 }
 
 #define HIDE_ALL_MAINS
 #include "plambda.c"
 
-float* execute_plambda(int n, float** x, int* w, int* h, int* pd,
-					   char* program, int* opd, char** error)
+struct plambda_program* plambda_compile(int n, const char* program, char* error)
 {
-	struct plambda_program* p = malloc(sizeof(*p));
+	struct plambda_context context;
+	context.error = error;
+	g_context = &context;
 
-	if (setjmp(g_jmpbuf)) {
+	struct plambda_program* volatile p = malloc(sizeof(*p));
+	p->var->n = 0;
+	if (setjmp(context.jmpbuf)) {
+		collection_of_varnames_end(p->var);
 		free(p);
-		*error = g_error;
-		return 0;
+		g_context = NULL;
+		return NULL;
 	}
 
 	plambda_compile_program(p, program);
@@ -46,7 +59,7 @@ float* execute_plambda(int n, float** x, int* w, int* h, int* pd,
 	if (n > 0 && p->var->n == 0) {
 		int maxplen = n*20 + strlen(program) + 100;
 		char newprogram[maxplen];
-		add_hidden_variables(newprogram, maxplen, n, program);
+		add_hidden_variables(newprogram, maxplen, n, (char*) program);
 		plambda_compile_program(p, newprogram);
 	}
 
@@ -54,16 +67,300 @@ float* execute_plambda(int n, float** x, int* w, int* h, int* pd,
 		fail("the program expects %d variables but %d images "
 			 "were given", p->var->n, n);
 
-	//print_compiled_program(p);
-	int pdreal = eval_dim(p, x, pd);
-
-	float *out = xmalloc(*w * *h * pdreal * sizeof*out);
-	*opd = run_program_vectorially(out, pdreal, p, x, w, h, pd);
-	assert(*opd == pdreal);
+	g_context = NULL;
+	return p;
+}
 
+void plambda_free(struct plambda_program* p)
+{
 	collection_of_varnames_end(p->var);
 	free(p);
-	return out;
+}
+
+int plambda_is_parallel(const struct plambda_program* p)
+{
+	for (int i = 0; i < p->n; i++) {
+		const struct plambda_token* t = p->t + i;
+		// the statistics of the magic variables are cached in globals
+		if (t->type == PLAMBDA_MAGIC)
+			return 0;
+		// and the random generators have a global state
+		if (t->type == PLAMBDA_OPERATOR
+				&& !strncmp(global_table_of_predefined_functions[t->index].name, "rand", 4))
+			return 0;
+	}
+	return 1;
+}
+
+int plambda_eval_dim(struct plambda_program* p, float** x, int* pd, char* error)
+{
+	struct plambda_context context;
+	context.error = error;
+	g_context = &context;
+	if (setjmp(context.jmpbuf)) {
+		g_context = NULL;
+		return 0;
+	}
+	int d = eval_dim(p, x, pd);
+	g_context = NULL;
+	return d;
+}
+
+// evaluation by blocks of pixels {{{1
+
+// the programs which only read the current pixel and apply elementwise functions
+// are run one token at a time over a block of pixels instead of one pixel at a time
+#define PLAMBDA_BLOCK_SIZE 256
+#define PLAMBDA_BLOCK_DEPTH 16
+#define PLAMBDA_BLOCK_DIM 4
+
+struct plambda_block_stack {
+	int n;
+	int d[PLAMBDA_BLOCK_DEPTH];
+	float t[PLAMBDA_BLOCK_DEPTH][PLAMBDA_BLOCK_DIM][PLAMBDA_BLOCK_SIZE];
+};
+
+// dimension of the result of an elementwise function, 0 if it can not vectorize
+static int block_function_dim(int *d, int nargs)
+{
+	int rd = 1;
+	for (int i = 0; i < nargs; i++)
+		if (d[i] > 1) {
+			if (rd > 1 && d[i] != rd)
+				return 0;
+			rd = d[i];
+		}
+	return rd;
+}
+
+// whether the program can be evaluated by blocks, the other programs keep
+// the pixelwise interpreter (which also reports their errors)
+static int program_has_blocks(struct plambda_program *p, int pdout,
+		int *w, int *h, int *pd)
+{
+	int n = 0, d[PLAMBDA_BLOCK_DEPTH];
+	for (int i = 0; i < p->n; i++) {
+		struct plambda_token *t = p->t + i;
+		int r;
+		switch (t->type) {
+		case PLAMBDA_CONSTANT:
+			r = 1;
+			break;
+		case PLAMBDA_SCALAR:
+		case PLAMBDA_VECTOR:
+			if (t->index >= p->var->n || w[t->index] != *w || h[t->index] != *h
+					|| t->displacement[0] || t->displacement[1])
+				return 0;
+			if (t->type == PLAMBDA_SCALAR) {
+				if (t->component < 0 || t->component >= pd[t->index])
+					return 0;
+				r = 1;
+			} else {
+				if (t->component != -1 || pd[t->index] > PLAMBDA_BLOCK_DIM)
+					return 0;
+				r = pd[t->index];
+			}
+			break;
+		case PLAMBDA_STACKOP:
+			if (t->index == PLAMBDA_STACKOP_DEL && n > 0) {
+				n--;
+				continue;
+			}
+			if (t->index != PLAMBDA_STACKOP_DUP || n < 1)
+				return 0;
+			r = d[n-1];
+			break;
+		case PLAMBDA_OPERATOR: {
+			struct predefined_function *f =
+				global_table_of_predefined_functions + t->index;
+			// the random generators must be called in the pixel order
+			if (f->nargs < 0 || f->nargs > 3 || f->nargs > n
+					|| !strncmp(f->name, "rand", 4))
+				return 0;
+			r = f->nargs ? block_function_dim(d + n - f->nargs, f->nargs) : 1;
+			if (!r)
+				return 0;
+			n -= f->nargs;
+			break;
+				       }
+		default:
+			return 0;
+		}
+		if (n == PLAMBDA_BLOCK_DEPTH)
+			return 0;
+		d[n++] = r;
+	}
+	return n > 0 && d[n-1] == pdout;
+}
+
+// whether the channels never mix, the interleaved samples can then be run as a single channel
+static int program_is_samplewise(struct plambda_program *p, int pdout, int *pd)
+{
+	for (int i = 0; i < p->n; i++) {
+		struct plambda_token *t = p->t + i;
+		if (t->type == PLAMBDA_SCALAR)
+			return 0;
+		if (t->type == PLAMBDA_VECTOR && pd[t->index] != pdout)
+			return 0;
+	}
+	return 1;
+}
+
+static void block_apply_function(struct plambda_block_stack *s,
+		struct predefined_function *f, int m)
+{
+	int k = f->nargs;
+	int *d = s->d + s->n - k;
+	int rd = k ? block_function_dim(d, k) : 1;
+	float (*a)[PLAMBDA_BLOCK_SIZE] = s->t[s->n - k];
+	if (!k) {
+		for (int i = 0; i < m; i++)
+			a[0][i] = f->value;
+		s->d[s->n++] = 1;
+		return;
+	}
+
+	// the result replaces the first argument, the channels are written in
+	// descending order so that a broadcast channel 0 is read before being overwritten
+	for (int l = rd - 1; l >= 0; l--) {
+		float *r = a[l];
+		const float *x = s->t[s->n - k][d[0] > 1 ? l : 0];
+		if (k == 1) {
+			double (*g)(double) = (double(*)(double)) f->f;
+			if (g == fabs)
+				for (int i = 0; i < m; i++) r[i] = fabsf(x[i]);
+			else if (g == sqrt)
+				for (int i = 0; i < m; i++) r[i] = sqrtf(x[i]);
+			else
+				for (int i = 0; i < m; i++) r[i] = g(x[i]);
+			continue;
+		}
+		const float *y = s->t[s->n - k + 1][d[1] > 1 ? l : 0];
+		if (k == 2) {
+			double (*g)(double,double) = (double(*)(double,double)) f->f;
+			if (g == sum_two_doubles)
+				for (int i = 0; i < m; i++) r[i] = x[i] + y[i];
+			else if (g == substract_two_doubles)
+				for (int i = 0; i < m; i++) r[i] = x[i] - y[i];
+			else if (g == multiply_two_doubles)
+				for (int i = 0; i < m; i++) r[i] = x[i] * y[i];
+			else if (g == divide_two_doubles)
+				for (int i = 0; i < m; i++) r[i] = x[i] / y[i];
+			else if (g == fmin)
+				for (int i = 0; i < m; i++) r[i] = fminf(x[i], y[i]);
+			else if (g == fmax)
+				for (int i = 0; i < m; i++) r[i] = fmaxf(x[i], y[i]);
+			else
+				for (int i = 0; i < m; i++) r[i] = g(x[i], y[i]);
+			continue;
+		}
+		const float *z = s->t[s->n - 1][d[2] > 1 ? l : 0];
+		double (*g)(double,double,double) =
+			(double(*)(double,double,double)) f->f;
+		for (int i = 0; i < m; i++) r[i] = g(x[i], y[i], z[i]);
+	}
+	s->n -= k;
+	s->d[s->n++] = rd;
+}
+
+// evaluates the pixels [i0,i0+m) of the row j
+static void run_program_on_block(float *out, int pdout, struct plambda_block_stack *s,
+		struct plambda_program *p, float **val, int w, int *pd,
+		int i0, int j, int m)
+{
+	s->n = 0;
+	for (int i = 0; i < p->n; i++) {
+		struct plambda_token *t = p->t + i;
+		float (*v)[PLAMBDA_BLOCK_SIZE] = s->t[s->n];
+		switch (t->type) {
+		case PLAMBDA_CONSTANT:
+			for (int k = 0; k < m; k++)
+				v[0][k] = t->value;
+			s->d[s->n++] = 1;
+			break;
+		case PLAMBDA_SCALAR: {
+			int pdv = pd[t->index];
+			const float *x = val[t->index] + ((size_t) j * w + i0) * pdv;
+			for (int k = 0; k < m; k++)
+				v[0][k] = x[k * pdv + t->component];
+			s->d[s->n++] = 1;
+				     }
+			break;
+		case PLAMBDA_VECTOR: {
+			int pdv = pd[t->index];
+			const float *x = val[t->index] + ((size_t) j * w + i0) * pdv;
+			for (int l = 0; l < pdv; l++)
+				for (int k = 0; k < m; k++)
+					v[l][k] = x[k * pdv + l];
+			s->d[s->n++] = pdv;
+				     }
+			break;
+		case PLAMBDA_STACKOP:
+			if (t->index == PLAMBDA_STACKOP_DEL) {
+				s->n--;
+			} else {
+				int dv = s->d[s->n - 1];
+				memcpy(v, s->t[s->n - 1], dv * sizeof*v);
+				s->d[s->n++] = dv;
+			}
+			break;
+		case PLAMBDA_OPERATOR:
+			block_apply_function(s,
+				global_table_of_predefined_functions + t->index, m);
+			break;
+		}
+	}
+
+	float (*r)[PLAMBDA_BLOCK_SIZE] = s->t[s->n - 1];
+	float *o = out + ((size_t) j * w + i0) * pdout;
+	for (int l = 0; l < pdout; l++)
+		for (int k = 0; k < m; k++)
+			o[k * pdout + l] = r[l][k];
+}
+
+int plambda_run_rows(float* out, int pdout, struct plambda_program* p,
+					 float** x, int* w, int* h, int* pd, int y0, int y1, char* error)
+{
+	struct plambda_context context;
+	context.error = error;
+	g_context = &context;
+	if (setjmp(context.jmpbuf)) {
+		g_context = NULL;
+		return 0;
+	}
+	// PLAMBDA_NOBLOCKS forces the pixelwise interpreter, to compare both
+	if (!getenv("PLAMBDA_NOBLOCKS") && program_has_blocks(p, pdout, w, h, pd)) {
+		int bw = *w, bpdout = pdout, bpd[p->var->n ? p->var->n : 1];
+		for (int i = 0; i < p->var->n; i++)
+			bpd[i] = pd[i];
+		if (program_is_samplewise(p, pdout, pd)) {
+			bw *= pdout;
+			bpdout = 1;
+			for (int i = 0; i < p->var->n; i++)
+				bpd[i] = 1;
+		}
+		struct plambda_block_stack *s = malloc(sizeof*s);
+		for (int j = y0; j < y1; j++)
+		for (int i = 0; i < bw; i += PLAMBDA_BLOCK_SIZE)
+		{
+			int m = bw - i < PLAMBDA_BLOCK_SIZE ? bw - i : PLAMBDA_BLOCK_SIZE;
+			run_program_on_block(out, bpdout, s, p, x, bw, bpd, i, j, m);
+		}
+		free(s);
+		g_context = NULL;
+		return 1;
+	}
+
+	for (int j = y0; j < y1; j++)
+	for (int i = 0; i < *w; i++)
+	{
+		float result[pdout];
+		int r = run_program_vectorially_at(result, p, x, w, h, pd, i, j);
+		if (r != pdout) fail("r != pdmax");
+		memcpy(out + ((size_t) j * *w + i) * pdout, result, pdout * sizeof*out);
+	}
+	g_context = NULL;
+	return 1;
 }
 
 // vim:set foldmethod=marker: